@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2011-2012 by Zhang Li <RichSelian at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE PROJECT AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE PROJECT OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+/*
+ * fuzz target for the decoder -- any input must be decoded or rejected without
+ * reading or writing out of bounds.
+ *  make fuzz                       build with clang and libFuzzer
+ *  -DFUZZ_STANDALONE               build a driver running the target over files in argv
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "../libcomprox/comprox.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    comprox_params_t params = {0};
+    void* dst;
+    size_t dst_size;
+
+    params.m_num_threads = 2; /* also run the pending block path */
+    if(comprox_decompress(&params, data, size, &dst, &dst_size) == 0) {
+        comprox_free(dst);
+    }
+    return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+int main(int argc, char** argv) {
+    FILE* fp;
+    uint8_t* data;
+    long size;
+    int i;
+
+    for(i = 1; i < argc; i++) {
+        if((fp = fopen(argv[i], "rb")) == NULL) {
+            perror("fopen");
+            return -1;
+        }
+        fseek(fp, 0, SEEK_END);
+        size = ftell(fp);
+        rewind(fp);
+        data = malloc(size + 1);
+        size = fread(data, 1, size, fp);
+        fclose(fp);
+
+        LLVMFuzzerTestOneInput(data, size);
+        free(data);
+    }
+    return 0;
+}
+#endif
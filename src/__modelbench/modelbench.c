@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2011-2012 by Zhang Li <RichSelian at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE PROJECT AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE PROJECT OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+/*
+ * benchmark for the model_t and fmodel_t layouts -- runs the encoder path (cum, frq, update)
+ * and the decoder path (decode lookup, update) over generated symbol streams.
+ *  gcc -O3 -o modelbench src/__modelbench/modelbench.c src/cr-model.c src/cr-fmodel.c
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../cr-model.h"
+#include "../cr-fmodel.h"
+
+#define N 20000000
+
+static uint8_t symbols[N];
+static uint32_t cums[N];
+
+static double now() {
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/* symbols with geometric frequencies, skew=0 gives a flat distribution */
+static void generate(int skew, uint32_t seed) {
+    uint32_t x = seed;
+    int i;
+    int v;
+
+    for(i = 0; i < N; i++) {
+        x = x * 1103515245 + 12345;
+        for(v = 0; skew > 0 && v < 255 && (x >> 16) % skew == 0; v++) {
+            x = x * 1103515245 + 12345;
+        }
+        symbols[i] = skew > 0 ? (v + 20) % 256 : (x >> 16) & 0xff; /* away from a bucket start */
+    }
+    return;
+}
+
+static void run(const char* name, int skew, int increment) {
+    static model_t m;
+    static fmodel_t f;
+    uint64_t check[4] = {0};
+    double t[4];
+    decode_symbol_t d;
+    int i;
+
+    generate(skew, 1);
+
+    model_init(&m);
+    t[0] = now();
+    for(i = 0; i < N; i++) {
+        check[0] += model_cum(&m, symbols[i]) + model_frq(&m, symbols[i]);
+        cums[i] = model_cum(&m, symbols[i]) + model_frq(&m, symbols[i]) / 2; /* a cum inside the symbol */
+        model_update(&m, symbols[i], increment);
+    }
+    t[0] = now() - t[0];
+
+    fmodel_init(&f);
+    t[1] = now();
+    for(i = 0; i < N; i++) {
+        check[1] += fmodel_cum(&f, symbols[i]) + fmodel_frq(&f, symbols[i]);
+        fmodel_update(&f, symbols[i], increment);
+    }
+    t[1] = now() - t[1];
+
+    model_init(&m);
+    t[2] = now();
+    for(i = 0; i < N; i++) {
+        d = model_get_decode_symbol(&m, cums[i]);
+        check[2] += d.m_sym + d.m_cum;
+        model_update(&m, d.m_sym, increment);
+    }
+    t[2] = now() - t[2];
+
+    fmodel_init(&f);
+    t[3] = now();
+    for(i = 0; i < N; i++) {
+        d = fmodel_get_decode_symbol(&f, cums[i]);
+        check[3] += d.m_sym + d.m_cum;
+        fmodel_update(&f, d.m_sym, increment);
+    }
+    t[3] = now() - t[3];
+
+    printf("%-8s inc=%-3d  encode: model_t %.3fs fmodel_t %.3fs  decode: model_t %.3fs fmodel_t %.3fs  %s\n",
+            name, increment, t[0], t[1], t[2], t[3],
+            (check[0] == check[1] && check[2] == check[3]) ? "ok" : "MISMATCH");
+    return;
+}
+
+int main(int argc, char** argv) {
+    run("flat", 0, 1);
+    run("skew/2", 2, 4);
+    run("skew/2", 2, 30);
+    run("skew/8", 8, 4);
+    run("skew/8", 8, 30);
+    run("skew/32", 32, 1);
+    return 0;
+}
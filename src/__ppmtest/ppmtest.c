@@ -36,10 +36,10 @@ int main(int argc, char** argv) {
             fwrite( ob.m_data, 1, ob.m_size, stdout);
         }
 
-        for(i = 0; i < 65536; i++) {
-            c += (model.o2_models[i] != NULL);
+        for(i = 0; i < (1u << (16 - model.o2_shift)); i++) {
+            c += model.o2_sets[i].m_used[0] + model.o2_sets[i].m_used[1];
         }
-        fprintf(stderr, "ppm-o2 %d of 65536 nodes used.\n", c);
+        fprintf(stderr, "ppm-o2 %d of %u nodes used.\n", c, 2u << (16 - model.o2_shift));
     }
     if(argc == 2 && strcmp(argv[1], "d") == 0) {
         while(fread(&ib.m_size, 1, sizeof(ib.m_size), stdin) > 0 && fread(&ob.m_size, 1, sizeof(ob.m_size), stdin) > 0) {
@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2011-2012 by Zhang Li <RichSelian at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE PROJECT AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE PROJECT OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include "cr-bitlit.h"
+
+int lit_coder = LIT_CODER_PPM;
+
+void bitlit_model_init(bitlit_model_t* model) {
+    int i;
+    int j;
+
+    for(i = 0; i < 256; i++) {
+        for(j = 0; j < 256; j++) {
+            model->m_p0[i][j] = 1 << (BITLIT_SHIFT - 1);
+        }
+    }
+    return;
+}
+
+/* p0 stays within [15, 4081], never reaching 0 or 1<<BITLIT_SHIFT */
+static inline void bitlit_update(uint16_t* p0, int bit) {
+    if(bit) {
+        *p0 -= *p0 >> BITLIT_RATE;
+    } else {
+        *p0 += ((1 << BITLIT_SHIFT) - *p0) >> BITLIT_RATE;
+    }
+    return;
+}
+
+void bitlit_encode(range_coder_t* coder, bitlit_model_t* model, uint32_t context, int encode_ch, data_block_t* o_block) {
+    uint16_t* p0 = model->m_p0[context & 0xff];
+    int node = 1;
+    int bit;
+    int i;
+
+    for(i = 7; i >= 0; i--) {
+        bit = (encode_ch >> i) & 1;
+        range_encoder_encode_bit(coder, p0[node], BITLIT_SHIFT, bit, o_block);
+        bitlit_update(&p0[node], bit);
+        node = node * 2 + bit;
+    }
+    return;
+}
+
+int bitlit_decode(range_coder_t* coder, bitlit_model_t* model, uint32_t context, uint8_t** input) {
+    uint16_t* p0 = model->m_p0[context & 0xff];
+    int node = 1;
+    int bit;
+
+    while(node < 256) {
+        bit = range_decoder_decode_bit(coder, p0[node], BITLIT_SHIFT, input);
+        bitlit_update(&p0[node], bit);
+        node = node * 2 + bit;
+    }
+    return node - 256;
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2011-2012 by Zhang Li <RichSelian at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE PROJECT AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE PROJECT OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef HEADER_CR_BITLIT_H
+#define HEADER_CR_BITLIT_H
+
+#include <stdint.h>
+#include "cr-rangecoder.h"
+#include "cr-datablock.h"
+
+/* literal coders, stored per block in the engine block headers */
+#define LIT_CODER_PPM 0
+#define LIT_CODER_BIT 1
+#define LIT_CODER_CM  2 /* ppm_cm_encode() */
+#define LIT_CODER_PPMH 3 /* ppmh_encode() */
+
+/* literal coder for new blocks, set by the -L switch */
+extern int lit_coder;
+
+/* binary literal coder -- a byte is coded as 8 binary decisions down a bit tree,
+ * each with a 12-bit probability under the previous byte, adapted by shifting.
+ * no frequency tables to scan, so every byte costs the same */
+#define BITLIT_SHIFT 12
+#define BITLIT_RATE  4
+
+typedef struct bitlit_model_t {
+    uint16_t m_p0[256][256]; /* [previous byte][bit tree node], probability of a 0 bit */
+} bitlit_model_t;
+
+void bitlit_model_init(bitlit_model_t* model);
+
+void bitlit_encode(range_coder_t* coder, bitlit_model_t* model, uint32_t context, int encode_ch, data_block_t* o_block);
+int bitlit_decode(range_coder_t* coder, bitlit_model_t* model, uint32_t context, uint8_t** input);
+
+#endif
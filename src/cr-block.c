@@ -0,0 +1,218 @@
+/*
+ * Copyright (C) 2011-2012 by Zhang Li <RichSelian at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE PROJECT AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE PROJECT OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <string.h>
+#include "cr-block.h"
+#include "cr-filter.h"
+#include "cr-dicpick.h"
+#include "cr-crc32c.h"
+
+block_worker_t* block_workers_create(const lz_engine_t* engine, dictionary_t* dic, int nworkers) {
+    block_worker_t* workers = calloc(nworkers, sizeof(block_worker_t));
+    int i;
+
+    for(i = 0; i < nworkers; i++) {
+        workers[i].m_engine = engine;
+        workers[i].m_ctx = engine->m_context_create();
+        workers[i].m_dic = dic;
+        workers[i].m_print_information = (nworkers == 1);
+    }
+    return workers;
+}
+
+void block_workers_destroy(block_worker_t* workers, int nworkers) {
+    int i;
+
+    for(i = 0; i < nworkers; i++) {
+        workers[i].m_engine->m_context_destroy(workers[i].m_ctx);
+        data_block_destroy(&workers[i].m_ib);
+        data_block_destroy(&workers[i].m_ob);
+    }
+    free(workers);
+    return;
+}
+
+void block_workers_carry(block_worker_t* workers, int nworkers, int npending) {
+    lz_context_t* tmpctx;
+
+    /* pass the last used context (and the pending block) to the first worker */
+    tmpctx = workers[0].m_ctx;
+    workers[0].m_ctx = workers[nworkers - 1].m_ctx;
+    workers[nworkers - 1].m_ctx = tmpctx;
+    if(npending) {
+        swap_xyblock(&workers[0].m_ib, &workers[nworkers].m_ib);
+        workers[0].m_header = workers[nworkers].m_header;
+    }
+    return;
+}
+
+/* reset models as the block header says, -1 if it needs trained models we do not have */
+static inline int reset_context(block_worker_t* worker) {
+    if(worker->m_header.m_reset == BLOCK_RESET_WARM) {
+        if(worker->m_snapshot == NULL) {
+            return -1;
+        }
+        return worker->m_engine->m_context_load(worker->m_ctx, worker->m_snapshot);
+    }
+    worker->m_engine->m_context_reset(worker->m_ctx);
+    return worker->m_header.m_reset == BLOCK_RESET_COLD ? 0 : -1;
+}
+
+void* encode_block_thread(block_worker_t* worker) { /* ib: original data => ob: compressed data */
+    data_block_t* xb = &worker->m_ib;
+    data_block_t* yb = &worker->m_ob;
+    int filt = 0;
+
+    worker->m_header.m_crc = crc32c(0, xb->m_data, xb->m_size);
+
+    /* precompress with filters */
+    if(worker->m_filt_enable) {
+        filt = filter_inplace(xb->m_data, xb->m_size, FILTER_ENC, worker->m_print_information);
+    }
+
+    /* encode */
+    data_block_resize(yb, 0);
+    dictionary_encode(worker->m_dic, xb, yb, worker->m_print_information);
+
+    if(!worker->m_prec_enable) {
+        swap_xyblock(xb, yb);
+        if(worker->m_header.m_reset) {
+            reset_context(worker);
+        }
+        data_block_resize(yb, 0);
+        worker->m_engine->m_encode(worker->m_ctx, xb, yb, worker->m_print_information);
+    }
+    worker->m_header.m_size = yb->m_size;
+    worker->m_header.m_filt = filt;
+    worker->m_header.m_prec = worker->m_prec_enable;
+    return NULL;
+}
+
+/* keep LZ_INPUT_PADDING zeros after an owned input block, borrowed blocks are padded by their owner */
+static inline void pad_input_block(data_block_t* block) {
+    if(!block->m_borrowed) {
+        data_block_reserve(block, block->m_size + LZ_INPUT_PADDING);
+        memset(block->m_data + block->m_size, 0, LZ_INPUT_PADDING);
+    }
+    return;
+}
+
+void* decode_block_thread(block_worker_t* worker) { /* ib: compressed data => ob: original data */
+    data_block_t* xb = &worker->m_ib;
+    data_block_t* yb = &worker->m_ob;
+
+    /* decode */
+    worker->m_corrupted = 1;
+    if(!worker->m_header.m_prec) {
+        if(worker->m_header.m_reset && reset_context(worker) != 0) {
+            return NULL;
+        }
+        data_block_resize(yb, 0);
+        pad_input_block(xb);
+        if(worker->m_engine->m_decode(worker->m_ctx, xb, yb, worker->m_print_information) != 0) {
+            return NULL;
+        }
+        swap_xyblock(xb, yb);
+    }
+    data_block_resize(yb, 0);
+    if(dictionary_decode(worker->m_dic, xb, yb, NULL, worker->m_print_information) != 0) {
+        return NULL;
+    }
+
+    /* precompress with filters */
+    if(worker->m_header.m_filt) {
+        filter_inplace(yb->m_data, yb->m_size, FILTER_DEC, worker->m_print_information);
+    }
+
+    /* verify checksum */
+    worker->m_corrupted = (crc32c(0, yb->m_data, yb->m_size) != worker->m_header.m_crc);
+    return NULL;
+}
+
+void run_workers(block_worker_t* workers, int nworkers, void* (*routine)(block_worker_t*)) {
+    int i;
+
+    if(nworkers == 1) { /* run in current thread */
+        routine(&workers[0]);
+        return;
+    }
+    for(i = 0; i < nworkers; i++) {
+        pthread_create(&workers[i].m_thread, 0, (void*)routine, &workers[i]);
+    }
+    for(i = 0; i < nworkers; i++) {
+        pthread_join(workers[i].m_thread, 0);
+    }
+    return;
+}
+
+int block_dictionary_encode(block_worker_t* worker, data_block_t* dic_xb, data_block_t* dic_yb) { /* xb: picked words => yb: compressed dictionary */
+    int nword;
+
+    nword = dictionary_load(worker->m_dic, (char*)dic_xb->m_data, 1);
+    dic_lcp_encode(dic_xb);
+    data_block_resize(dic_yb, 0);
+    worker->m_engine->m_encode(worker->m_ctx, dic_xb, dic_yb, 0);
+    worker->m_engine->m_context_reset(worker->m_ctx);
+    return nword;
+}
+
+int block_dictionary_decode(block_worker_t* worker, data_block_t* dic_yb, data_block_t* dic_xb) { /* yb: compressed dictionary => xb: words */
+    int ret;
+
+    data_block_resize(dic_xb, 0);
+    pad_input_block(dic_yb);
+    ret = worker->m_engine->m_decode(worker->m_ctx, dic_yb, dic_xb, 0);
+    worker->m_engine->m_context_reset(worker->m_ctx);
+    if(ret != 0 || dic_lcp_decode(dic_xb) != 0 || dictionary_load(worker->m_dic, (char*)dic_xb->m_data, 0) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+void block_index_add(data_block_t* index, uint64_t raw_offset, uint64_t offset) {
+    block_index_entry_t entry = {raw_offset, offset};
+    uint32_t pos = index->m_size;
+
+    data_block_resize(index, pos + sizeof(entry));
+    memcpy(index->m_data + pos, &entry, sizeof(entry));
+    return;
+}
+
+void block_index_seal(data_block_t* index, uint64_t raw_size, uint64_t index_offset) { /* append trailer */
+    block_index_trailer_t trailer;
+    uint32_t pos = index->m_size;
+
+    trailer.m_raw_size = raw_size;
+    trailer.m_index_offset = index_offset;
+    trailer.m_nblock = index->m_size / sizeof(block_index_entry_t);
+    memcpy(trailer.m_magic, BLOCK_INDEX_MAGIC, sizeof(trailer.m_magic));
+
+    data_block_resize(index, pos + sizeof(trailer));
+    memcpy(index->m_data + pos, &trailer, sizeof(trailer));
+    return;
+}
@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2011-2012 by Zhang Li <RichSelian at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE PROJECT AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE PROJECT OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef HEADER_CR_BLOCK_H
+#define HEADER_CR_BLOCK_H
+
+#include <stdint.h>
+#include "cr-datablock.h"
+#include "cr-diccode.h"
+#include "cr-engine.h"
+#include "miniport-thread.h"
+
+/* block header */
+typedef struct block_header_t {
+    uint32_t m_size;
+    uint8_t  m_filt;
+    uint8_t  m_prec;
+    uint8_t  m_reset; /* models are reset before this block (BLOCK_RESET_*), so it does not depend on previous blocks */
+    uint32_t m_crc;   /* crc32c of original data */
+} __attribute__((packed)) block_header_t;
+
+/* m_reset values -- a warm reset starts from the trained models given with -W */
+#define BLOCK_RESET_COLD 1
+#define BLOCK_RESET_WARM 2
+
+/* block index -- written behind the end-of-blocks marker (a block header with m_size = 0),
+ * maps offsets of original data to offsets of blocks in the compressed stream
+ */
+#define BLOCK_INDEX_MAGIC "CRIX"
+
+/* block sizes are stored in 32 bits */
+#define BLOCK_SIZE_MAX (4095ULL * 1048576)
+
+typedef struct block_index_entry_t {
+    uint64_t m_raw_offset;      /* offset of the block in original data */
+    uint64_t m_offset;          /* offset of the block header in compressed stream */
+} __attribute__((packed)) block_index_entry_t;
+
+typedef struct block_index_trailer_t {
+    uint64_t m_raw_size;        /* size of original data */
+    uint64_t m_index_offset;    /* offset of the first index entry in compressed stream */
+    uint32_t m_nblock;
+    char     m_magic[4];
+} __attribute__((packed)) block_index_trailer_t;
+
+/* block worker -- codes one block with its own codec context */
+typedef struct block_worker_t {
+    const lz_engine_t* m_engine;
+    lz_context_t*  m_ctx;
+    dictionary_t*  m_dic;
+    data_block_t*  m_snapshot; /* trained models for BLOCK_RESET_WARM, NULL without -W */
+    data_block_t   m_ib;
+    data_block_t   m_ob;
+    block_header_t m_header;
+    uint64_t       m_raw_offset; /* offset of the block in original data */
+    pthread_t      m_thread;
+    int            m_filt_enable;
+    int            m_prec_enable;
+    int            m_print_information;
+    int            m_corrupted; /* set by decode_block_thread() on corrupted input or checksum mismatch */
+} block_worker_t;
+
+/* swap block */
+static inline void swap_xyblock(data_block_t* xb, data_block_t* yb) {
+    data_block_t tmpblock = *xb;
+    *xb = *yb;
+    *yb = tmpblock;
+    return;
+}
+
+block_worker_t* block_workers_create(const lz_engine_t* engine, dictionary_t* dic, int nworkers);
+void block_workers_destroy(block_worker_t* workers, int nworkers);
+void block_workers_carry(block_worker_t* workers, int nworkers, int npending);
+
+void* encode_block_thread(block_worker_t* worker);
+void* decode_block_thread(block_worker_t* worker);
+void run_workers(block_worker_t* workers, int nworkers, void* (*routine)(block_worker_t*));
+
+void block_index_add(data_block_t* index, uint64_t raw_offset, uint64_t offset);
+void block_index_seal(data_block_t* index, uint64_t raw_size, uint64_t index_offset);
+
+int  block_dictionary_encode(block_worker_t* worker, data_block_t* dic_xb, data_block_t* dic_yb);
+int  block_dictionary_decode(block_worker_t* worker, data_block_t* dic_yb, data_block_t* dic_xb); /* -1 on corrupted input */
+
+#endif
@@ -26,32 +26,70 @@
  * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
  * SUCH DAMAGE.
  */
+#include <string.h>
 #include "cr-datablock.h"
 
-void data_block_reserve(data_block_t* block, uint32_t size) {
+static void data_block_realloc(data_block_t* block, uint64_t capacity) {
+    uint8_t* data;
+
+    if(block->m_borrowed) { /* copy borrowed data to an owned buffer */
+        data = malloc(capacity);
+        memcpy(data, block->m_data, (block->m_size < capacity) ? block->m_size : capacity);
+        block->m_data = data;
+        block->m_borrowed = 0;
+    } else {
+        block->m_data = realloc(block->m_data, capacity);
+    }
+    block->m_capacity = capacity;
+    return;
+}
+
+void data_block_reserve(data_block_t* block, uint64_t size) {
+    if(block->m_borrowed) {
+        if(size > block->m_size) {
+            data_block_realloc(block, size * 1.2);
+        }
+        return;
+    }
     if(size > block->m_capacity || size < block->m_capacity / 2) {
-        block->m_capacity = size * 1.2;
-        block->m_data = realloc(block->m_data, block->m_capacity);
+        data_block_realloc(block, size * 1.2);
     }
     return;
 }
 
-void data_block_resize(data_block_t* block, uint32_t size) {
+void data_block_resize(data_block_t* block, uint64_t size) {
     data_block_reserve(block, size);
     block->m_size = size;
     return;
 }
 
 void data_block_add(data_block_t* block, uint8_t byte) {
-    if(block->m_size == block->m_capacity) {
-        block->m_capacity = block->m_size * 1.2 + 1;
-        block->m_data = realloc(block->m_data, block->m_capacity);
+    if(block->m_borrowed || block->m_size == block->m_capacity) {
+        data_block_realloc(block, block->m_size * 1.2 + 1);
     }
     block->m_data[block->m_size++] = byte;
     return;
 }
 
+void data_block_append(data_block_t* block, const void* data, uint64_t size) {
+    data_block_reserve(block, block->m_size + size);
+    memcpy(block->m_data + block->m_size, data, size);
+    block->m_size += size;
+    return;
+}
+
+void data_block_borrow(data_block_t* block, uint8_t* data, uint64_t size) {
+    data_block_destroy(block);
+    block->m_data = data;
+    block->m_size = size;
+    block->m_capacity = 0;
+    block->m_borrowed = 1;
+    return;
+}
+
 void data_block_destroy(data_block_t* block) {
-    free(block->m_data);
+    if(!block->m_borrowed) {
+        free(block->m_data);
+    }
     return;
 }
@@ -34,15 +34,18 @@
 
 typedef struct data_block_t {
     uint8_t* m_data;
-    uint32_t m_size;
-    uint32_t m_capacity;
+    uint64_t m_size;
+    uint64_t m_capacity;
+    int      m_borrowed; /* m_data is not owned (like a mapped file), copied on first growth */
 } data_block_t;
 
 static const data_block_t INITIAL_BLOCK = {0};
 
-void data_block_reserve(data_block_t* block, uint32_t size);
-void data_block_resize(data_block_t* block, uint32_t size);
+void data_block_reserve(data_block_t* block, uint64_t size);
+void data_block_resize(data_block_t* block, uint64_t size);
 void data_block_add(data_block_t* block, uint8_t byte);
+void data_block_append(data_block_t* block, const void* data, uint64_t size);
+void data_block_borrow(data_block_t* block, uint8_t* data, uint64_t size);
 void data_block_destroy(data_block_t* block);
 
 #endif
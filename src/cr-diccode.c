@@ -30,116 +30,134 @@
 #include "cr-datablock.h"
 #include "miniport-thread.h"
 
-static char    dic[TOTAL_WORD_NUM][WORD_MAXLEN + 2]; /* most words terminated with \x20\x0 */
-static uint8_t dicstrlen[TOTAL_WORD_NUM]; /* WORD_MAXLEN + 2 < 256 */
-static int     dic_len;
-
 typedef struct trie_node_t {
     int m_id;
     int m_next[128];
 } trie_node_t;
 
-static trie_node_t* mem_nodes;
-static uint32_t nnode;
-static uint32_t nword;
-static uint32_t ncapacity;
-
-static inline void dictionary_add_word(const char* word) {
+static inline void dictionary_add_word(dictionary_t* dic, const char* word) {
     uint32_t node = 0;
     uint32_t i = 0;
     unsigned char ch;
 
     while(word[i] != 0) {
         ch = word[i];
-        if(mem_nodes[node].m_next[ch] == 0) {
-            if(nnode >= ncapacity) { /* allocate more nodes */
-                ncapacity = nnode * 1.33 + 1;
-                mem_nodes = realloc(mem_nodes, ncapacity * sizeof(trie_node_t));
+        if(dic->m_nodes[node].m_next[ch] == 0) {
+            if(dic->m_nnode >= dic->m_ncapacity) { /* allocate more nodes */
+                dic->m_ncapacity = dic->m_nnode * 1.33 + 1;
+                dic->m_nodes = realloc(dic->m_nodes, dic->m_ncapacity * sizeof(trie_node_t));
             }
-            memset(mem_nodes + nnode, 0, sizeof(trie_node_t));
-            mem_nodes[node].m_id = -1;
-            mem_nodes[node].m_next[ch] = nnode++;
+            memset(dic->m_nodes + dic->m_nnode, 0, sizeof(trie_node_t));
+            dic->m_nodes[node].m_id = -1;
+            dic->m_nodes[node].m_next[ch] = dic->m_nnode++;
         }
         if(ch != 0) {
-            node = mem_nodes[node].m_next[ch];
+            node = dic->m_nodes[node].m_next[ch];
             i += 1;
         }
     }
-    mem_nodes[node].m_id = nword++;
+    dic->m_nodes[node].m_id = dic->m_ntrieword++;
+    return;
+}
+
+void dictionary_init(dictionary_t* dic) {
+    dic->m_nwords = 0;
+    dic->m_nodes = NULL;
+    dic->m_nnode = 0;
+    dic->m_ncapacity = 0;
+    dic->m_ntrieword = 0;
     return;
 }
 
-static inline void atexit_free_nodes() {
-    free(mem_nodes);
+void dictionary_free(dictionary_t* dic) {
+    free(dic->m_nodes);
+    dictionary_init(dic);
+    return;
 }
 
-int dictionary_load(const char* dicstr, int init_trie) { /* return number of words */
+int dictionary_load(dictionary_t* dic, const char* dicstr, int init_trie) { /* return number of words, or -1 on malformed dicstr */
     int len = strlen(dicstr);
     int i;
     int p = 0;
 
     /* fill dictionary */
     for(i = 0; i < len; i++) {
+        if(dic->m_nwords >= TOTAL_WORD_NUM) {
+            return -1;
+        }
         if(dicstr[i] == '\n') {
-            if(isalpha(dic[dic_len][p - 1])) { /* terminate a normal word by \x20\x00 */
-                dic[dic_len][p++] = '\x20';
-                dic[dic_len][p++] = '\x00';
+            if(p == 0) { /* empty word */
+                return -1;
+            }
+            if(isalpha(dic->m_words[dic->m_nwords][p - 1])) { /* terminate a normal word by \x20\x00 */
+                dic->m_words[dic->m_nwords][p++] = '\x20';
+                dic->m_words[dic->m_nwords][p++] = '\x00';
+            } else {
+                dic->m_words[dic->m_nwords][p++] = '\x00';
             }
             p = 0;
-            dic_len++;
+            dic->m_nwords++;
         } else {
-            dic[dic_len][p++] = dicstr[i];
+            if(p >= WORD_MAXLEN) {
+                return -1;
+            }
+            dic->m_words[dic->m_nwords][p++] = dicstr[i];
         }
     }
+    for(i = 0; i < dic->m_nwords; i++) { /* calculate length of each word */
+        dic->m_wordlen[i] = strlen(dic->m_words[i]);
+    }
 
     /* init dictionary trie */
     if(init_trie) {
-        mem_nodes = calloc(4096, sizeof(trie_node_t));
-        nnode = 1; /* for root */
-        nword = 0;
-        ncapacity = 4096;
-        atexit(atexit_free_nodes);
-
-        for(i = 0; i < dic_len; i++) { /* init with static dicionary */
-            dictionary_add_word(dic[i]);
+        free(dic->m_nodes);
+        dic->m_nodes = calloc(4096, sizeof(trie_node_t));
+        dic->m_nnode = 1; /* for root */
+        dic->m_ntrieword = 0;
+        dic->m_ncapacity = 4096;
+
+        for(i = 0; i < dic->m_nwords; i++) { /* init with static dicionary */
+            dictionary_add_word(dic, dic->m_words[i]);
         }
 
         for(i = 'A'; i < 'Z'; i++) { /* link uppercase leading words */
-            mem_nodes[0].m_next[i] = mem_nodes[0].m_next[tolower(i)];
+            dic->m_nodes[0].m_next[i] = dic->m_nodes[0].m_next[tolower(i)];
         }
-        for(i = 0; i < nnode; i++) { /* link words ended with [';' ':' ',' '.'] */
-            if(mem_nodes[i].m_next[' '] > 0) {
-                if(!mem_nodes[i].m_next['.']) mem_nodes[i].m_next['.'] = mem_nodes[i].m_next[' '];
-                if(!mem_nodes[i].m_next[',']) mem_nodes[i].m_next[','] = mem_nodes[i].m_next[' '];
-                if(!mem_nodes[i].m_next[':']) mem_nodes[i].m_next[':'] = mem_nodes[i].m_next[' '];
-                if(!mem_nodes[i].m_next[';']) mem_nodes[i].m_next[';'] = mem_nodes[i].m_next[' '];
+        for(i = 0; i < dic->m_nnode; i++) { /* link words ended with [';' ':' ',' '.'] */
+            if(dic->m_nodes[i].m_next[' '] > 0) {
+                if(!dic->m_nodes[i].m_next['.']) dic->m_nodes[i].m_next['.'] = dic->m_nodes[i].m_next[' '];
+                if(!dic->m_nodes[i].m_next[',']) dic->m_nodes[i].m_next[','] = dic->m_nodes[i].m_next[' '];
+                if(!dic->m_nodes[i].m_next[':']) dic->m_nodes[i].m_next[':'] = dic->m_nodes[i].m_next[' '];
+                if(!dic->m_nodes[i].m_next[';']) dic->m_nodes[i].m_next[';'] = dic->m_nodes[i].m_next[' '];
             }
         }
     }
-    return nword;
+    return dic->m_ntrieword;
 }
 
 /* pthread-callback wrapper */
 typedef struct dictionary_encode_param_pack_t {
+    dictionary_t* m_dic;
     unsigned char* m_data;
     uint32_t m_size;
     uint8_t  m_esc[10];
     data_block_t* m_oblock;
+    int m_corrupted;
 } dictionary_encode_param_pack_t;
 
-static void dictionary_encode_imp(unsigned char* data, uint32_t size, uint8_t esc[10], data_block_t* ob);
-static void dictionary_decode_imp(unsigned char* data, uint32_t size, uint8_t esc[10], data_block_t* ob);
+static void dictionary_encode_imp(dictionary_t* dic, unsigned char* data, uint32_t size, uint8_t esc[10], data_block_t* ob);
+static int  dictionary_decode_imp(dictionary_t* dic, unsigned char* data, uint32_t size, uint8_t esc[10], data_block_t* ob);
 
 static void* dictionary_encode_imp_thread(dictionary_encode_param_pack_t* args) {
-    dictionary_encode_imp(args->m_data, args->m_size, args->m_esc, args->m_oblock);
+    dictionary_encode_imp(args->m_dic, args->m_data, args->m_size, args->m_esc, args->m_oblock);
     return 0;
 }
 static void* dictionary_decode_imp_thread(dictionary_encode_param_pack_t* args) {
-    dictionary_decode_imp(args->m_data, args->m_size, args->m_esc, args->m_oblock);
+    args->m_corrupted = (dictionary_decode_imp(args->m_dic, args->m_data, args->m_size, args->m_esc, args->m_oblock) != 0);
     return 0;
 }
 
-void dictionary_encode(data_block_t* ib, data_block_t* ob) {
+void dictionary_encode(dictionary_t* dic, data_block_t* ib, data_block_t* ob, int print_information) {
     uint32_t size1 = ib->m_size / 2;
     uint32_t size2 = ib->m_size - size1;
     data_block_t ob1 = INITIAL_BLOCK;
@@ -154,7 +172,9 @@ void dictionary_encode(data_block_t* ib, data_block_t* ob) {
     uint32_t pos = 0;
     uint8_t  esc[10] = {0};
 
-    fprintf(stderr, "%s\n", "-> running static dictionary encoding...");
+    if(print_information) {
+        fprintf(stderr, "%s\n", "-> running static dictionary encoding...");
+    }
     data_block_resize(ob, 0);
 
     /* find esc symbol */
@@ -180,6 +200,7 @@ void dictionary_encode(data_block_t* ib, data_block_t* ob) {
         pos += size2;
 
         /* thread 1 for first half */
+        args1.m_dic = dic;
         args1.m_data = ib->m_data + pos - size2 - size1;
         args1.m_size = size1;
         args1.m_oblock = &ob1;
@@ -187,6 +208,7 @@ void dictionary_encode(data_block_t* ib, data_block_t* ob) {
         pthread_create(&thread1, 0, (void*)dictionary_encode_imp_thread, &args1);
 
         /* thread 2 for second half */
+        args2.m_dic = dic;
         args2.m_data = ib->m_data + pos - size2;
         args2.m_size = size2;
         args2.m_oblock = &ob2;
@@ -220,7 +242,7 @@ void dictionary_encode(data_block_t* ib, data_block_t* ob) {
     return;
 }
 
-void dictionary_decode(data_block_t* ib, data_block_t* ob, FILE* fpout_sync) {
+int dictionary_decode(dictionary_t* dic, data_block_t* ib, data_block_t* ob, FILE* fpout_sync, int print_information) {
     uint32_t size1;
     uint32_t size2;
     uint8_t  esc[10];
@@ -230,14 +252,23 @@ void dictionary_decode(data_block_t* ib, data_block_t* ob, FILE* fpout_sync) {
     pthread_t thread2;
     dictionary_encode_param_pack_t args1;
     dictionary_encode_param_pack_t args2;
-    uint32_t pos = 0;
+    uint64_t pos = 0;
+    int corrupted = 0;
 
-    fprintf(stderr, "%s\n", "-> running static dictionary decoding...");
+    if(print_information) {
+        fprintf(stderr, "%s\n", "-> running static dictionary decoding...");
+    }
 
+    if(ib->m_size == 0) {
+        return -1;
+    }
     if(ib->m_data[ib->m_size - 1] == 0) { /* not compressed */
         data_block_resize(ob, ib->m_size - 1);
         memcpy(ob->m_data, ib->m_data, ib->m_size - 1);
-        return;
+        return 0;
+    }
+    if(ib->m_size < sizeof(esc) + 1) {
+        return -1;
     }
 
     /* extract esc chars */
@@ -247,16 +278,26 @@ void dictionary_decode(data_block_t* ib, data_block_t* ob, FILE* fpout_sync) {
         data_block_resize(&ob1, 0);
         data_block_resize(&ob2, 0);
 
+        if(pos + 8 + sizeof(esc) + 1 > ib->m_size) {
+            corrupted = 1;
+            break;
+        }
         size1 = *(uint32_t*)(ib->m_data + pos);
         size2 = *(uint32_t*)(ib->m_data + pos + 4);
-        pos += 8 + size1 + size2;
+        if((uint64_t)size1 + size2 > ib->m_size - (sizeof(esc) + 1) - (pos + 8)) {
+            corrupted = 1;
+            break;
+        }
+        pos += 8 + (uint64_t)size1 + size2;
 
+        args1.m_dic = dic;
         args1.m_data = ib->m_data + pos - size2 - size1;
         args1.m_size = size1;
         args1.m_oblock = &ob1;
         memcpy(args1.m_esc, esc, sizeof(args1.m_esc));
         pthread_create(&thread1, 0, (void*)dictionary_decode_imp_thread, &args1);
 
+        args2.m_dic = dic;
         args2.m_data = ib->m_data + pos - size2;
         args2.m_size = size2;
         args2.m_oblock = &ob2;
@@ -265,6 +306,10 @@ void dictionary_decode(data_block_t* ib, data_block_t* ob, FILE* fpout_sync) {
 
         pthread_join(thread1, 0);
         pthread_join(thread2, 0);
+        if(args1.m_corrupted || args2.m_corrupted) {
+            corrupted = 1;
+            break;
+        }
 
         size1 = ob1.m_size;
         size2 = ob2.m_size;
@@ -279,10 +324,10 @@ void dictionary_decode(data_block_t* ib, data_block_t* ob, FILE* fpout_sync) {
     }
     data_block_destroy(&ob1);
     data_block_destroy(&ob2);
-    return;
+    return corrupted ? -1 : 0;
 }
 
-static void dictionary_encode_imp(unsigned char* data, uint32_t size, uint8_t esc[10], data_block_t* ob) {
+static void dictionary_encode_imp(dictionary_t* dic, unsigned char* data, uint32_t size, uint8_t esc[10], data_block_t* ob) {
     trie_node_t* node;
     int i;
     int j;
@@ -299,15 +344,15 @@ static void dictionary_encode_imp(unsigned char* data, uint32_t size, uint8_t es
     }
     for(i = 0; i + WORD_MAXLEN * 2 < size; i++) { /* avoid overflow */
         j = i;
-        node = mem_nodes;
+        node = dic->m_nodes;
 
         /* match word in trie */
         if(i > 0 && isalpha(data[i]) && !isalpha(data[i - 1])) {
-            while(data[j] < 128 && (node = mem_nodes + node->m_next[data[j]]) != mem_nodes && node->m_id == -1) {
+            while(data[j] < 128 && (node = dic->m_nodes + node->m_next[data[j]]) != dic->m_nodes && node->m_id == -1) {
                 j += 1;
             }
         } else {
-            node = mem_nodes; /* skip non-words */
+            node = dic->m_nodes; /* skip non-words */
         }
 
 #define M_check_reverse_case(s,i) ((i)>=3 && (s)[(i)-1]==' ' && ((s)[(i)-2]=='.' || ((s)[(i)-2]==' ' && (s)[(i)-3]=='.')))
@@ -324,13 +369,13 @@ static void dictionary_encode_imp(unsigned char* data, uint32_t size, uint8_t es
                 enddot?     1 : 0)];
 
         /* output code for a word */
-        if(data[j] < 128 && node != mem_nodes) {
-            if(node->m_id < LEVEL1_WORD_NUM(dic_len)) { /* 1-byte code */
+        if(data[j] < 128 && node != dic->m_nodes) {
+            if(node->m_id < LEVEL1_WORD_NUM(dic->m_nwords)) { /* 1-byte code */
                 data_block_add(ob, node->m_id);
                 data_block_add(ob, escchar);
             } else {                                    /* 2-byte code */
-                data_block_add(ob, node->m_id / (256 - LEVEL1_WORD_NUM(dic_len)));
-                data_block_add(ob, node->m_id % (256 - LEVEL1_WORD_NUM(dic_len)) + LEVEL1_WORD_NUM(dic_len));
+                data_block_add(ob, node->m_id / (256 - LEVEL1_WORD_NUM(dic->m_nwords)));
+                data_block_add(ob, node->m_id % (256 - LEVEL1_WORD_NUM(dic->m_nwords)) + LEVEL1_WORD_NUM(dic->m_nwords));
                 data_block_add(ob, escchar);
             }
             i = j;
@@ -339,8 +384,8 @@ static void dictionary_encode_imp(unsigned char* data, uint32_t size, uint8_t es
             if(!escmap[data[i]]) {
                 data_block_add(ob, data[i]);
             } else {
-                data_block_add(ob, dic_len / (256 - LEVEL1_WORD_NUM(dic_len)));
-                data_block_add(ob, dic_len % (256 - LEVEL1_WORD_NUM(dic_len)) + LEVEL1_WORD_NUM(dic_len));
+                data_block_add(ob, dic->m_nwords / (256 - LEVEL1_WORD_NUM(dic->m_nwords)));
+                data_block_add(ob, dic->m_nwords % (256 - LEVEL1_WORD_NUM(dic->m_nwords)) + LEVEL1_WORD_NUM(dic->m_nwords));
                 data_block_add(ob, data[i]);
             }
         }
@@ -350,8 +395,8 @@ static void dictionary_encode_imp(unsigned char* data, uint32_t size, uint8_t es
         if(!escmap[data[i]]) {
             data_block_add(ob, data[i]);
         } else {
-            data_block_add(ob, dic_len / (256 - LEVEL1_WORD_NUM(dic_len)));
-            data_block_add(ob, dic_len % (256 - LEVEL1_WORD_NUM(dic_len)) + LEVEL1_WORD_NUM(dic_len));
+            data_block_add(ob, dic->m_nwords / (256 - LEVEL1_WORD_NUM(dic->m_nwords)));
+            data_block_add(ob, dic->m_nwords % (256 - LEVEL1_WORD_NUM(dic->m_nwords)) + LEVEL1_WORD_NUM(dic->m_nwords));
             data_block_add(ob, data[i]);
         }
         i += 1;
@@ -361,7 +406,7 @@ static void dictionary_encode_imp(unsigned char* data, uint32_t size, uint8_t es
     return;
 }
 
-static void dictionary_decode_imp(unsigned char* data, uint32_t size, uint8_t esc[10], data_block_t* ob) {
+static int dictionary_decode_imp(dictionary_t* dic, unsigned char* data, uint32_t size, uint8_t esc[10], data_block_t* ob) {
     int dstpos;
     int ch;
     int id;
@@ -370,40 +415,55 @@ static void dictionary_decode_imp(unsigned char* data, uint32_t size, uint8_t es
     uint32_t srcpos;
     uint32_t reverse_pos = -1;
 
-    for(i = 0; i < dic_len; i++) { /* calculate length of each word */
-        dicstrlen[i] = strlen(dic[i]);
-    }
     for(i = 0; i < 10; i++) { /* init escape map */
         escmap[esc[i]] = i + 1;
     }
 
+    if(size < 4) {
+        return -1;
+    }
     srcpos = *(uint32_t*)(data + size - 4);
     dstpos = size - 4;
+    if(srcpos > (uint64_t)dstpos * (WORD_MAXLEN + 1)) { /* a code never expands to more than a word */
+        return -1;
+    }
     data_block_resize(ob, srcpos);
 
     while(srcpos > 0) {
+        if(dstpos <= 0) {
+            return -1;
+        }
         if(!escmap[ch = data[--dstpos]]) {
             ob->m_data[--srcpos] = ch;
         } else {
-            if((id = data[--dstpos]) >= LEVEL1_WORD_NUM(dic_len)) {
-                id = data[--dstpos] * (256 - LEVEL1_WORD_NUM(dic_len)) + (id - LEVEL1_WORD_NUM(dic_len)); /* 2-byte code */
-                if(id == dic_len) {
+            if(dstpos <= 0) {
+                return -1;
+            }
+            if((id = data[--dstpos]) >= LEVEL1_WORD_NUM(dic->m_nwords)) {
+                if(dstpos <= 0) {
+                    return -1;
+                }
+                id = data[--dstpos] * (256 - LEVEL1_WORD_NUM(dic->m_nwords)) + (id - LEVEL1_WORD_NUM(dic->m_nwords)); /* 2-byte code */
+                if(id == dic->m_nwords) {
                     ob->m_data[--srcpos] = ch; /* esc char */
                     continue;
                 }
             }
+            if(id >= dic->m_nwords || dic->m_wordlen[id] > srcpos) {
+                return -1;
+            }
 
 #define M_reverse_case(c) ((c)^0x20) /* (islower(c)? toupper(c) : tolower(c)) */
 
             /* recover word */
-            srcpos -= dicstrlen[id];
-            memcpy(ob->m_data + srcpos, dic[id], dicstrlen[id]);
+            srcpos -= dic->m_wordlen[id];
+            memcpy(ob->m_data + srcpos, dic->m_words[id], dic->m_wordlen[id]);
 
             switch(escmap[ch]) {
-                case 2: case 7:  ob->m_data[srcpos + dicstrlen[id] - 1] = '.'; break;
-                case 3: case 8:  ob->m_data[srcpos + dicstrlen[id] - 1] = ','; break;
-                case 4: case 9:  ob->m_data[srcpos + dicstrlen[id] - 1] = ';'; break;
-                case 5: case 10: ob->m_data[srcpos + dicstrlen[id] - 1] = ':'; break;
+                case 2: case 7:  ob->m_data[srcpos + dic->m_wordlen[id] - 1] = '.'; break;
+                case 3: case 8:  ob->m_data[srcpos + dic->m_wordlen[id] - 1] = ','; break;
+                case 4: case 9:  ob->m_data[srcpos + dic->m_wordlen[id] - 1] = ';'; break;
+                case 5: case 10: ob->m_data[srcpos + dic->m_wordlen[id] - 1] = ':'; break;
             }
             if(escmap[ch] >= 6) { /* reverse case */
                 ob->m_data[srcpos] = M_reverse_case(ob->m_data[srcpos]);
@@ -421,5 +481,5 @@ static void dictionary_decode_imp(unsigned char* data, uint32_t size, uint8_t es
     if(reverse_pos != -1 && M_check_reverse_case(ob->m_data, reverse_pos)) {
         ob->m_data[reverse_pos] = M_reverse_case(ob->m_data[reverse_pos]);
     }
-    return;
+    return 0;
 }
@@ -41,10 +41,25 @@
 #define WORD_MINLEN         2
 #define WORD_MAXLEN         20
 
-int dictionary_load(const char* dicstr, int init_trie);
+/* static dictionary context -- read-only after dictionary_load(), so it can be
+ * shared by all threads coding blocks of the same stream */
+typedef struct dictionary_t {
+    char     m_words[TOTAL_WORD_NUM][WORD_MAXLEN + 2]; /* most words terminated with \x20\x0 */
+    uint8_t  m_wordlen[TOTAL_WORD_NUM]; /* WORD_MAXLEN + 2 < 256 */
+    int      m_nwords;
+
+    struct trie_node_t* m_nodes;
+    uint32_t m_nnode;
+    uint32_t m_ncapacity;
+    uint32_t m_ntrieword;
+} dictionary_t;
+
+void dictionary_init(dictionary_t* dic);
+void dictionary_free(dictionary_t* dic);
+int  dictionary_load(dictionary_t* dic, const char* dicstr, int init_trie);
 
 struct data_block_t;
-void dictionary_encode(struct data_block_t* i_block, struct data_block_t* o_block);
-void dictionary_decode(struct data_block_t* i_block, struct data_block_t* o_block, FILE* fpout_sync);
+void dictionary_encode(dictionary_t* dic, struct data_block_t* i_block, struct data_block_t* o_block, int print_information);
+int  dictionary_decode(dictionary_t* dic, struct data_block_t* i_block, struct data_block_t* o_block, FILE* fpout_sync, int print_information);
 
 #endif
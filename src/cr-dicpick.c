@@ -30,6 +30,7 @@
 #include "cr-datablock.h"
 #include "cr-diccode.h"
 #include "miniport-thread.h"
+#include "miniport-mmap.h"
 
 #define HASHMAP_MAXSIZE     (TOTAL_WORD_NUM * 13 + 1)
 #define HASHMAP_CAPACITY    (TOTAL_WORD_NUM * 23 + 3)
@@ -49,8 +50,10 @@ typedef struct hashmap_element_t {
     int  m_count;
 } hashmap_element_t;
 
-static hashmap_element_t hashmap_data[HASHMAP_CAPACITY];
-static int hashmap_size;
+typedef struct hashmap_t {
+    hashmap_element_t m_data[HASHMAP_CAPACITY];
+    int m_size;
+} hashmap_t;
 
 static inline int hashmap_element_cmp_by_words(const void* pa, const void* pb) {
     hashmap_element_t* ea = (hashmap_element_t*)pa;
@@ -92,52 +95,52 @@ static inline void copyword(char* dst, const char* src) { /* copy a word */
     *dst = '\0';
     return;
 }
-static inline void addword(const char* s) {
+static inline void addword(hashmap_t* hashmap, const char* s) {
     int hash_pos = hashword(s) % HASHMAP_CAPACITY;
     int i;
     int min_count;
     hashmap_element_t* backup_data;
 
-    while(hashmap_data[hash_pos].m_count > 0 && cmpword(hashmap_data[hash_pos].m_word, s) != 0) {
+    while(hashmap->m_data[hash_pos].m_count > 0 && cmpword(hashmap->m_data[hash_pos].m_word, s) != 0) {
         hash_pos = (hash_pos + 1) % HASHMAP_CAPACITY;
     }
-    if(hashmap_data[hash_pos].m_count > 0) { /* word existed */
-        hashmap_data[hash_pos].m_count += 1;
+    if(hashmap->m_data[hash_pos].m_count > 0) { /* word existed */
+        hashmap->m_data[hash_pos].m_count += 1;
         return;
     }
 
     /* add a new word */
-    copyword(hashmap_data[hash_pos].m_word, s);
-    hashmap_size += 1;
-    hashmap_data[hash_pos].m_count = 1;
+    copyword(hashmap->m_data[hash_pos].m_word, s);
+    hashmap->m_size += 1;
+    hashmap->m_data[hash_pos].m_count = 1;
 
     /* remove less used words when hashmap is full */
-    if(hashmap_size == HASHMAP_MAXSIZE) {
+    if(hashmap->m_size == HASHMAP_MAXSIZE) {
         backup_data = malloc(HASHMAP_MAXSIZE * sizeof(hashmap_element_t));
         min_count = INT_MAX;
 
         for(i = 0; i < HASHMAP_CAPACITY; i++) {
-            if(hashmap_data[i].m_count > 0) {
-                if(hashmap_data[i].m_count < min_count) {
-                    min_count = hashmap_data[i].m_count;
+            if(hashmap->m_data[i].m_count > 0) {
+                if(hashmap->m_data[i].m_count < min_count) {
+                    min_count = hashmap->m_data[i].m_count;
                 }
-                strcpy(backup_data[hashmap_size - 1].m_word, hashmap_data[i].m_word);
-                backup_data[hashmap_size - 1].m_count = hashmap_data[i].m_count;
-                hashmap_size -= 1;
+                strcpy(backup_data[hashmap->m_size - 1].m_word, hashmap->m_data[i].m_word);
+                backup_data[hashmap->m_size - 1].m_count = hashmap->m_data[i].m_count;
+                hashmap->m_size -= 1;
             }
-            hashmap_data[i].m_count = 0;
+            hashmap->m_data[i].m_count = 0;
         }
 
         for(i = 0; i < HASHMAP_MAXSIZE; i++) {
             if(backup_data[i].m_count > min_count + 5) { /* regard words with (count <= min_count + 5) as "less used" */
                 hash_pos = hashword(backup_data[i].m_word) % HASHMAP_CAPACITY;
 
-                while(hashmap_data[hash_pos].m_count > 0 && cmpword(hashmap_data[hash_pos].m_word, backup_data[i].m_word) != 0) {
+                while(hashmap->m_data[hash_pos].m_count > 0 && cmpword(hashmap->m_data[hash_pos].m_word, backup_data[i].m_word) != 0) {
                     hash_pos = (hash_pos + 1) % HASHMAP_CAPACITY;
                 }
-                strcpy(hashmap_data[hash_pos].m_word, backup_data[i].m_word);
-                hashmap_data[hash_pos].m_count = backup_data[i].m_count;
-                hashmap_size += 1;
+                strcpy(hashmap->m_data[hash_pos].m_word, backup_data[i].m_word);
+                hashmap->m_data[hash_pos].m_count = backup_data[i].m_count;
+                hashmap->m_size += 1;
             }
         }
         free(backup_data);
@@ -147,6 +150,7 @@ static inline void addword(const char* s) {
 
 /* pthread-callback wrapper */
 typedef struct addword_thread_param_pack_t {
+    hashmap_t* m_hashmap;
     unsigned char (*m_words)[WORD_MAXLEN + 2];
     int m_nwords;
 } addword_thread_param_pack_t;
@@ -154,16 +158,31 @@ typedef struct addword_thread_param_pack_t {
 static void* addword_thread(addword_thread_param_pack_t* args) { /* thread for adding word */
     int i;
     for(i = 0; i < args->m_nwords; i++) {
-        addword((char*)args->m_words[i]);
+        addword(args->m_hashmap, (char*)args->m_words[i]);
     }
     return NULL;
 }
 
 #define FDATA_BLOCK 200000
 
-void dicpick(FILE* fp, data_block_t* dic_block) {
-    static unsigned char words[2][FDATA_BLOCK / WORD_MINLEN][WORD_MAXLEN + 2];
-    static unsigned char fdata[FDATA_BLOCK];
+/* read next chunk of words from either a file or a memory buffer */
+static inline int dicpick_read(FILE* fp, const unsigned char** data, uint64_t* size, unsigned char* fdata) {
+    int flen;
+
+    if(fp != NULL) {
+        return fread(fdata, 1, FDATA_BLOCK, fp);
+    }
+    flen = (*size < FDATA_BLOCK) ? *size : FDATA_BLOCK;
+    memcpy(fdata, *data, flen);
+    *data += flen;
+    *size -= flen;
+    return flen;
+}
+
+static void dicpick_imp(FILE* fp, const unsigned char* data, uint64_t size, int mapped, data_block_t* dic_block) {
+    unsigned char (*words)[FDATA_BLOCK / WORD_MINLEN][WORD_MAXLEN + 2] = malloc(2 * sizeof(*words));
+    unsigned char* fdata = malloc(FDATA_BLOCK);
+    hashmap_t* hashmap = calloc(1, sizeof(hashmap_t));
     int nwords = 0;
     int flen;
     int x;
@@ -171,6 +190,8 @@ void dicpick(FILE* fp, data_block_t* dic_block) {
     int p;
     int short_word = 0;
     uint8_t accept_suffixes[256] = {0};
+    const unsigned char* map = data;
+    uint64_t released = 0;
 
     pthread_t thread;
     addword_thread_param_pack_t args;
@@ -183,12 +204,16 @@ void dicpick(FILE* fp, data_block_t* dic_block) {
     accept_suffixes[';'] = 1;
 
     /* for first join */
+    args.m_hashmap = hashmap;
     args.m_nwords = 0;
     args.m_words = NULL;
     pthread_create(&thread, NULL, (void*)addword_thread, &args);
 
     /* split words */
-    while((flen = fread(fdata, 1, sizeof(fdata), fp)) > 0) {
+    while((flen = dicpick_read(fp, &data, &size, fdata)) > 0) {
+        if(mapped) { /* keep resident pages of a mapped file small */
+            released = mmap_file_release((unsigned char*)map, released, data - map);
+        }
         fdata[flen - 1] = 0;
         x = 1;
         nwords = 0;
@@ -218,13 +243,13 @@ void dicpick(FILE* fp, data_block_t* dic_block) {
     /* sort words by count */
     y = 0;
     for(x = 0; x < HASHMAP_CAPACITY; x++) {
-        if(hashmap_data[x].m_count > WORD_MIN_FREQ) { /* ignore "less used" words */
-            copyword(hashmap_data[y].m_word, hashmap_data[x].m_word);
-            hashmap_data[y].m_count = hashmap_data[x].m_count;
+        if(hashmap->m_data[x].m_count > WORD_MIN_FREQ) { /* ignore "less used" words */
+            copyword(hashmap->m_data[y].m_word, hashmap->m_data[x].m_word);
+            hashmap->m_data[y].m_count = hashmap->m_data[x].m_count;
             y++;
         }
     }
-    qsort(hashmap_data, y, sizeof(hashmap_element_t), hashmap_element_reverse_cmp_by_count);
+    qsort(hashmap->m_data, y, sizeof(hashmap_element_t), hashmap_element_reverse_cmp_by_count);
 
     /* sort level-2 words by name */
     if(y > TOTAL_WORD_NUM - reserved_wordnum) {
@@ -232,11 +257,11 @@ void dicpick(FILE* fp, data_block_t* dic_block) {
     }
     if(y > LEVEL1_WORD_NUM(y) - reserved_wordnum) {
         x = LEVEL1_WORD_NUM(y) - reserved_wordnum;
-        qsort(hashmap_data + x, y - x, sizeof(hashmap_element_t), hashmap_element_cmp_by_words);
+        qsort(hashmap->m_data + x, y - x, sizeof(hashmap_element_t), hashmap_element_cmp_by_words);
     }
 
     /* output */
-    data_block_reserve(dic_block, (hashmap_size + reserved_wordnum) * (WORD_MAXLEN + 3));
+    data_block_reserve(dic_block, (hashmap->m_size + reserved_wordnum) * (WORD_MAXLEN + 3));
     for(x = 0; x < reserved_wordnum; x++) {
         for(p = 0; reserved_words[x][p] != 0; p++) {
             data_block_add(dic_block, reserved_words[x][p]);
@@ -245,9 +270,9 @@ void dicpick(FILE* fp, data_block_t* dic_block) {
     }
 
     for(x = 0; x < y; x++) {
-        if(x < LEVEL1_WORD_NUM(y) || strlen(hashmap_data[x].m_word) >= WORD_MINLEN + 1) { /* ignore too short words */
-            for(p = 0; hashmap_data[x].m_word[p] != 0; p++) {
-                data_block_add(dic_block, hashmap_data[x].m_word[p]);
+        if(x < LEVEL1_WORD_NUM(y) || strlen(hashmap->m_data[x].m_word) >= WORD_MINLEN + 1) { /* ignore too short words */
+            for(p = 0; hashmap->m_data[x].m_word[p] != 0; p++) {
+                data_block_add(dic_block, hashmap->m_data[x].m_word[p]);
             }
             data_block_add(dic_block, '\n');
         } else {
@@ -255,6 +280,25 @@ void dicpick(FILE* fp, data_block_t* dic_block) {
         }
     }
     data_block_add(dic_block, 0);
+
+    free(hashmap);
+    free(fdata);
+    free(words);
+    return;
+}
+
+void dicpick(FILE* fp, data_block_t* dic_block) {
+    dicpick_imp(fp, NULL, 0, 0, dic_block);
+    return;
+}
+
+void dicpick_buffer(const unsigned char* data, uint64_t size, data_block_t* dic_block) {
+    dicpick_imp(NULL, data, size, 0, dic_block);
+    return;
+}
+
+void dicpick_map(unsigned char* map, uint64_t size, data_block_t* dic_block) {
+    dicpick_imp(NULL, map, size, 1, dic_block);
     return;
 }
 
@@ -304,31 +348,35 @@ void dic_lcp_encode(struct data_block_t* dic_block) {
     return;
 }
 
-void dic_lcp_decode(struct data_block_t* dic_block) {
+int dic_lcp_decode(struct data_block_t* dic_block) { /* return -1 on malformed input */
     data_block_t out_block = INITIAL_BLOCK;
-    int wi = 0;
-    int wo = 0;
+    uint64_t wi = 0;
+    uint64_t wo = 0;
     int lcp;
 
     /* decode first word */
-    while(dic_block->m_data[wi] != '\n') {
+    while(wi < dic_block->m_size && dic_block->m_data[wi] != '\n') {
         data_block_add(&out_block, dic_block->m_data[wi++]);
     }
-    wi++;
+    if(wi++ >= dic_block->m_size) {
+        goto Malformed;
+    }
     data_block_add(&out_block, '\n');
 
     /* decode rest word */
-    while(dic_block->m_data[wi] != 255) {
+    while(wi < dic_block->m_size && dic_block->m_data[wi] != 255) {
         lcp = dic_block->m_data[wi++];
         while(lcp > 0) {
             lcp--;
             data_block_add(&out_block, out_block.m_data[wo++]);
         }
 
-        while(dic_block->m_data[wi] != '\n') {
+        while(wi < dic_block->m_size && dic_block->m_data[wi] != '\n') {
             data_block_add(&out_block, dic_block->m_data[wi++]);
         }
-        wi++;
+        if(wi++ >= dic_block->m_size) {
+            goto Malformed;
+        }
         data_block_add(&out_block, '\n');
 
         while(out_block.m_data[wo] != '\n') {
@@ -336,11 +384,18 @@ void dic_lcp_decode(struct data_block_t* dic_block) {
         }
         wo++;
     }
+    if(wi >= dic_block->m_size) {
+        goto Malformed;
+    }
     data_block_add(&out_block, 0);
 
     /* copy back to dic_block */
     data_block_resize(dic_block, out_block.m_size);
     memcpy(dic_block->m_data, out_block.m_data, out_block.m_size);
     data_block_destroy(&out_block);
-    return;
+    return 0;
+
+Malformed:
+    data_block_destroy(&out_block);
+    return -1;
 }
@@ -34,11 +34,14 @@
 #include <string.h>
 #include <ctype.h>
 #include <limits.h>
+#include <stdint.h>
 
 struct data_block_t;
 
 void dicpick(FILE* fp, struct data_block_t* dic_block);
+void dicpick_buffer(const unsigned char* data, uint64_t size, struct data_block_t* dic_block);
+void dicpick_map(unsigned char* map, uint64_t size, struct data_block_t* dic_block); /* pages are released after being read */
 void dic_lcp_encode(struct data_block_t* dic_block);
-void dic_lcp_decode(struct data_block_t* dic_block);
+int  dic_lcp_decode(struct data_block_t* dic_block);
 
 #endif
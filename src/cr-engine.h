@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2011-2012 by Zhang Li <RichSelian at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE PROJECT AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE PROJECT OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef HEADER_CR_ENGINE_H
+#define HEADER_CR_ENGINE_H
+
+#include <stdint.h>
+
+struct data_block_t;
+
+/* decoders may read up to this many bytes past the end of their input block,
+ * so input bounds are checked once per decoded symbol instead of on every byte.
+ * callers keep that many readable bytes after each input block.
+ */
+#define LZ_INPUT_PADDING 64
+
+/* codec context -- models, coders and block header of one stream */
+typedef struct lz_context_t lz_context_t;
+
+/* lz engine -- each of roxmain/rolzmain/ropmain exports one descriptor */
+typedef struct lz_engine_t {
+    const char* m_name;
+    const char* m_magic_header;
+    lz_context_t* (*m_context_create)();
+    void (*m_context_reset)(lz_context_t* ctx);
+    void (*m_context_destroy)(lz_context_t* ctx);
+    void (*m_context_save)(lz_context_t* ctx, struct data_block_t* snapshot);
+    int  (*m_context_load)(lz_context_t* ctx, struct data_block_t* snapshot); /* resets first, -1 on a snapshot of another build */
+    void (*m_encode)(lz_context_t* ctx, struct data_block_t* ib, struct data_block_t* ob, int print_information);
+    int  (*m_decode)(lz_context_t* ctx, struct data_block_t* ib, struct data_block_t* ob, int print_information); /* -1 on corrupted input */
+} lz_engine_t;
+
+/* implement in
+ *  src/roxmain/cr-coder.c
+ *  src/rolzmain/cr-coder.c
+ *  src/ropmain/cr-coder.c
+ */
+extern const lz_engine_t lz_engine_rox;
+extern const lz_engine_t lz_engine_rolz;
+extern const lz_engine_t lz_engine_rop;
+
+#endif
@@ -30,28 +30,40 @@
 #include "filter_x86opcode.h"
 #include "filter_bmp.h"
 
-int filter_inplace(unsigned char* buf, uint32_t len, int en_de) {
-    typedef uint32_t (*filter_subproc)(uint8_t* buf, uint32_t len, int en_de);
+int filter_inplace(unsigned char* buf, uint32_t len, int en_de, int print_information) {
+    typedef uint32_t (*filter_subproc)(void* state, uint8_t* buf, uint32_t len, int en_de);
+
+    /* subproc states live in this call, so filtering is reentrant */
+    i386_transform_state_t pe_state = {0};
+    i386_transform_state_t elf_state = {0};
+    bmp_transform_state_t bmp_state = {0};
 
     filter_subproc subprocs[] = {
         pe_i386_transform,
         elf_i386_transform,
         bmp_transform,
     };
-    static filter_subproc lastproc = 0;
+    void* states[] = {
+        &pe_state,
+        &elf_state,
+        &bmp_state,
+    };
+    int lastproc = -1;
 
     int filt = 0;
     int pos;
     int i;
     int filtsize;
 
-    fprintf(stderr, "%s\n", "-> running filters...");
+    if(print_information) {
+        fprintf(stderr, "%s\n", "-> running filters...");
+    }
 
     for(pos = 0; pos < len; pos++) {
-        if(lastproc) {
-            filtsize = lastproc(buf + pos, len - pos, en_de); /* use last matched filter first */
+        if(lastproc >= 0) {
+            filtsize = subprocs[lastproc](states[lastproc], buf + pos, len - pos, en_de); /* use last matched filter first */
             if(filtsize == 0) {
-                lastproc = 0;
+                lastproc = -1;
             } else {
                 filt = 1;
                 pos += filtsize - 1;
@@ -60,10 +72,10 @@ int filter_inplace(unsigned char* buf, uint32_t len, int en_de) {
         }
 
         for(i = 0; i < sizeof(subprocs) / sizeof(*subprocs); i++) {
-            filtsize = subprocs[i](buf + pos, len - pos, en_de);
+            filtsize = subprocs[i](states[i], buf + pos, len - pos, en_de);
             if(filtsize > 0) {
                 filt = 1;
-                lastproc = subprocs[i];
+                lastproc = i;
                 pos += filtsize - 1;
                 break;
             }
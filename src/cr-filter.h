@@ -35,6 +35,6 @@
 #define FILTER_ENC 0
 #define FILTER_DEC 1
 
-int filter_inplace(unsigned char* buf, uint32_t len, int en_de);
+int filter_inplace(unsigned char* buf, uint32_t len, int en_de, int print_information);
 
 #endif
@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2011-2012 by Zhang Li <RichSelian at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE PROJECT AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE PROJECT OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include "cr-fmodel.h"
+
+void fmodel_init(fmodel_t* model) {
+    int i;
+
+    for(i = 0; i < 256; i++) {
+        model->m_frq_table[i] = 1;
+    }
+    fmodel_recalc_cum(model);
+    return;
+}
+
+void fmodel_recalc_cum(fmodel_t* model) {
+    int i;
+
+    model->m_tree[0] = 0;
+    model->m_sum = 0;
+    for(i = 1; i <= 256; i++) {
+        model->m_tree[i] = model->m_frq_table[i - 1];
+        model->m_sum += model->m_frq_table[i - 1];
+    }
+    for(i = 1; i < 256; i++) { /* push each node into its parent, O(n) build */
+        if(i + (i & -i) <= 256) {
+            model->m_tree[i + (i & -i)] += model->m_tree[i];
+        }
+    }
+    return;
+}
+
+int fmodel_update(fmodel_t* model, int symbol, int32_t increment) {
+    int i;
+
+    model->m_frq_table[symbol] += increment;
+    model->m_sum += increment;
+    for(i = symbol + 1; i <= 256; i += i & -i) {
+        model->m_tree[i] += increment;
+    }
+
+    if(model->m_sum > 32000) {
+        for(i = 0; i < 256; i++) {
+            model->m_frq_table[i] = (model->m_frq_table[i] + 1) / 2;
+        }
+        fmodel_recalc_cum(model);
+        return 1;
+    }
+    return 0;
+}
+
+int fmodel_cum(fmodel_t* model, int symbol) {
+    int cum = 0;
+    int i;
+
+    for(i = symbol; i > 0; i -= i & -i) {
+        cum += model->m_tree[i];
+    }
+    return cum;
+}
+
+int fmodel_frq(fmodel_t* model, int symbol) {
+    return model->m_frq_table[symbol];
+}
+
+int fmodel_sum(fmodel_t* model) {
+    return model->m_sum;
+}
+
+decode_symbol_t fmodel_get_decode_symbol(fmodel_t* model, int cum) {
+    decode_symbol_t ret;
+    int step;
+    int pos = 0;
+    int rest = cum;
+
+    /* descend to the last symbol whose cum is <= cum */
+    for(step = 128; step > 0; step /= 2) {
+        if(model->m_tree[pos + step] <= rest) {
+            pos += step;
+            rest -= model->m_tree[pos];
+        }
+    }
+    ret.m_sym = pos;
+    ret.m_cum = cum - rest;
+    return ret;
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2011-2012 by Zhang Li <RichSelian at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE PROJECT AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE PROJECT OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <string.h>
+#include "cr-history.h"
+
+int history_window = 0;
+
+/* (history + block) is addressed with 32-bit positions */
+#define M_history_limit (4095ULL * 1048576)
+
+uint32_t history_usable(data_block_t* history, uint32_t size) {
+    if(size >= M_history_limit) {
+        return 0;
+    }
+    return (history->m_size < M_history_limit - size) ? history->m_size : M_history_limit - size;
+}
+
+/* hb = last hlen bytes of history + ib, ib is borrowed without history */
+void history_join(data_block_t* history, uint32_t hlen, data_block_t* ib, data_block_t* hb) {
+    if(hlen == 0) {
+        data_block_borrow(hb, ib->m_data, ib->m_size);
+        return;
+    }
+    data_block_resize(hb, 0);
+    data_block_append(hb, history->m_data + history->m_size - hlen, hlen);
+    data_block_append(hb, ib->m_data, ib->m_size);
+    return;
+}
+
+/* keep the last window bytes of (history + data) */
+void history_update(data_block_t* history, uint8_t* data, uint32_t size, uint32_t window) {
+    uint64_t keep;
+
+    if(size >= window) {
+        data_block_resize(history, window);
+        if(window > 0) {
+            memcpy(history->m_data, data + size - window, window);
+        }
+        return;
+    }
+    keep = (history->m_size < window - size) ? history->m_size : window - size;
+    if(keep > 0) {
+        memmove(history->m_data, history->m_data + history->m_size - keep, keep);
+    }
+    data_block_resize(history, keep);
+    data_block_append(history, data, size);
+    return;
+}
+
+void history_prefix(data_block_t* history, uint32_t hlen, data_block_t* ob) {
+    data_block_resize(ob, 0);
+    if(hlen > 0) {
+        data_block_append(ob, history->m_data + history->m_size - hlen, hlen);
+    }
+    return;
+}
+
+void history_strip(data_block_t* history, uint32_t hlen, data_block_t* ob, uint32_t window) {
+    history_update(history, ob->m_data + hlen, ob->m_size - hlen, window);
+    if(hlen > 0) {
+        memmove(ob->m_data, ob->m_data + hlen, ob->m_size - hlen);
+        ob->m_size -= hlen;
+    }
+    return;
+}
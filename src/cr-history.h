@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2011-2012 by Zhang Li <RichSelian at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE PROJECT AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE PROJECT OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef HEADER_CR_HISTORY_H
+#define HEADER_CR_HISTORY_H
+
+#include <stdint.h>
+#include "cr-datablock.h"
+
+/* matcher history -- the tail of earlier blocks, kept in the codec context until it is reset.
+ * a block is matched as (history + block), so its matches may reach back across the block
+ * boundary. the decoder keeps the same tail of decoded blocks, so only the window is stored
+ * in the block header */
+#define HISTORY_MAX_WINDOW 1024 /* MB */
+
+/* window for new blocks (MB), set by the -H switch, 0 = no history */
+extern int history_window;
+
+uint32_t history_usable(data_block_t* history, uint32_t size); /* history bytes a block of size can use */
+void history_join(data_block_t* history, uint32_t hlen, data_block_t* ib, data_block_t* hb);
+void history_update(data_block_t* history, uint8_t* data, uint32_t size, uint32_t window);
+
+/* decoders -- decode behind a copy of the history, then strip it and keep the new tail */
+void history_prefix(data_block_t* history, uint32_t hlen, data_block_t* ob);
+void history_strip(data_block_t* history, uint32_t hlen, data_block_t* ob, uint32_t window);
+
+#endif
@@ -113,3 +113,62 @@ decode_symbol_t model_get_decode_symbol(model_t* model, int cum) {
     }
     return ret;
 }
+
+void nmodel_init(nmodel_t* model) {
+    model_init(&model->m_adaptive);
+    nmodel_recalc(model);
+    return;
+}
+
+static void nmodel_normalize(nmodel_t* model) {
+    uint32_t scale = (1u << 31) / model_sum(&model->m_adaptive);
+    uint32_t cum = 0;
+    uint32_t frq;
+    uint32_t top_frq = 0;
+    int      top_symbol = 0;
+    int      i;
+    int      s;
+
+    /* counts sum to at most 32000 < 1<<M_nmodel_shift, so no used symbol rounds down to 0 */
+    for(i = 0; i < 256; i++) {
+        model->m_cum[i] = cum;
+        frq = (model->m_adaptive.m_frq_table[i] * scale) >> (31 - M_nmodel_shift);
+        cum += frq;
+        if(frq > top_frq) {
+            top_frq = frq;
+            top_symbol = i;
+        }
+    }
+
+    /* give the rounding residue to the most frequent symbol */
+    for(i = top_symbol + 1; i < 256; i++) {
+        model->m_cum[i] += (1 << M_nmodel_shift) - cum;
+    }
+    model->m_cum[256] = 1 << M_nmodel_shift;
+
+    /* first symbol of every lookup slot */
+    for(i = 0, s = 0; i < (1 << M_nmodel_lookup_bits); i++) {
+        while(model->m_cum[s + 1] <= i << (M_nmodel_shift - M_nmodel_lookup_bits)) {
+            s += 1;
+        }
+        model->m_lookup[i] = s;
+    }
+    return;
+}
+
+void nmodel_recalc(nmodel_t* model) {
+    model_recalc_cum(&model->m_adaptive);
+    nmodel_normalize(model);
+    model->m_pending = model_sum(&model->m_adaptive) >> M_nmodel_drift;
+    return;
+}
+
+void nmodel_update(nmodel_t* model, int symbol, int32_t increment) {
+    model_update(&model->m_adaptive, symbol, increment);
+
+    if((model->m_pending -= increment) <= 0) { /* counts drifted too far from the coding table */
+        nmodel_normalize(model);
+        model->m_pending = model_sum(&model->m_adaptive) >> M_nmodel_drift;
+    }
+    return;
+}
@@ -54,6 +54,45 @@ int model_frq(model_t* model, int symbol);
 int model_sum(model_t* model);
 decode_symbol_t model_get_decode_symbol(model_t* model, int cum);
 
+/* normalized model -- coding frequencies always sum to 1<<M_nmodel_shift, so the
+ * range coder shifts instead of dividing. the adaptive counts are rescaled into
+ * the coding table once their increments exceed 1/(1<<M_nmodel_drift) of the sum.
+ * the coding table is semi-static, so it keeps full cums and a cum->symbol lookup
+ * rebuilt with it -- a decode is one lookup and rarely a step or two */
+#define M_nmodel_shift          15
+#define M_nmodel_drift          6
+#define M_nmodel_lookup_bits    10
+
+typedef struct nmodel_t {
+    model_t  m_adaptive;
+    uint16_t m_cum[257];
+    uint8_t  m_lookup[1 << M_nmodel_lookup_bits];
+    int32_t  m_pending;
+} nmodel_t;
+
+void nmodel_init(nmodel_t* model);
+void nmodel_recalc(nmodel_t* model);
+void nmodel_update(nmodel_t* model, int symbol, int32_t increment);
+
+static inline int nmodel_cum(nmodel_t* model, int symbol) {
+    return model->m_cum[symbol];
+}
+
+static inline int nmodel_frq(nmodel_t* model, int symbol) {
+    return model->m_cum[symbol + 1] - model->m_cum[symbol];
+}
+
+static inline decode_symbol_t nmodel_get_decode_symbol(nmodel_t* model, int cum) {
+    decode_symbol_t ret;
+
+    ret.m_sym = model->m_lookup[cum >> (M_nmodel_shift - M_nmodel_lookup_bits)];
+    while(model->m_cum[ret.m_sym + 1] <= cum) {
+        ret.m_sym += 1;
+    }
+    ret.m_cum = model->m_cum[ret.m_sym];
+    return ret;
+}
+
 /* cooperation with range coder */
 #define M_my_enc_(coder, o_block, model, symbol, update) \
     (range_encoder_encode(&coder, \
@@ -73,4 +112,22 @@ decode_symbol_t model_get_decode_symbol(model_t* model, int cum);
      (void)((update) && (model_update(&(model), decode_helper.m_sym, (update)), 0)), \
      decode_helper.m_sym)
 
+#define M_nm_enc_(coder, o_block, model, symbol, update) \
+    (range_encoder_encode_shift(&coder, \
+                                nmodel_cum(&(model), (symbol)), \
+                                nmodel_frq(&(model), (symbol)), \
+                                M_nmodel_shift, \
+                                o_block), \
+     (void)((update) && (nmodel_update(&(model), (symbol), (update)), 0)))
+
+#define M_nm_dec_(coder, input, model, update) \
+    (decode_helper.m_cum = range_decoder_decode_cum_shift(&coder, M_nmodel_shift), \
+     decode_helper = nmodel_get_decode_symbol(&(model), decode_helper.m_cum), \
+     range_decoder_decode(&coder, \
+         decode_helper.m_cum, \
+         nmodel_frq(&(model), decode_helper.m_sym), \
+         1 << M_nmodel_shift, &input), \
+     (void)((update) && (nmodel_update(&(model), decode_helper.m_sym, (update)), 0)), \
+     decode_helper.m_sym)
+
 #endif
@@ -26,16 +26,42 @@
  * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
  * SUCH DAMAGE.
  */
+#include <math.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include "cr-rangecoder.h"
 #include "cr-o2model.h"
 #include "cr-datablock.h"
 #include "cr-ppm.h"
 
+int ppm_o2_budget = PPM_O2_MAX_BUDGET;
+
+/* as many sets as the budget holds, all empty. -1 leaves no arena (o2_budget = 0) */
+static int ppm_o2_arena_init(ppm_model_t* model, int o2_budget) {
+    model->o2_sets = NULL;
+    model->o2_budget = 0;
+    if(o2_budget < PPM_O2_MIN_BUDGET || o2_budget > PPM_O2_MAX_BUDGET) {
+        return -1;
+    }
+    for(model->o2_shift = 1; model->o2_shift < 16 && (2u << (16 - model->o2_shift)) * (sizeof(o2_model_t) + sizeof(ppm_o2_set_t) / 2) > o2_budget * 1024u; model->o2_shift++);
+    model->o2_hash = (model->o2_shift == 1) ? 1 : 0x9e3b;
+    model->o2_sets = malloc((1u << (16 - model->o2_shift)) * (sizeof(ppm_o2_set_t) + 2 * sizeof(o2_model_t)));
+    if(model->o2_sets == NULL) {
+        return -1;
+    }
+    model->o2_models = (o2_model_t*)(model->o2_sets + (1u << (16 - model->o2_shift)));
+    model->o2_budget = o2_budget;
+    memset(model->o2_sets, 0, (1u << (16 - model->o2_shift)) * sizeof(ppm_o2_set_t));
+    return 0;
+}
+
 void ppm_model_init(ppm_model_t* model) {
     int i;
     int j;
 
-    memset(model->o2_models, 0, sizeof(model->o2_models));
+    ppm_o2_arena_init(model, ppm_o2_budget); /* without memory ppm_model_setup() tries again */
+
     memset(model->o1_models, 0, sizeof(model->o1_models));
     for(i = 0; i < 256; i++) {
         for(j = 0; j < 256; j++) {
@@ -43,23 +69,52 @@ void ppm_model_init(ppm_model_t* model) {
         }
     }
     model->context = 0;
+    model->cm = NULL;
     memset(model->o3_predict, 0, sizeof(model->o3_predict));
     return;
 }
 
+int ppm_model_setup(ppm_model_t* model, int o2_budget) {
+    if(model->o2_budget != o2_budget) {
+        free(model->o2_sets);
+        return ppm_o2_arena_init(model, o2_budget);
+    }
+    return 0;
+}
+
 void ppm_model_free(ppm_model_t* model) {
-    int i;
+    free(model->o2_sets);
+    model->o2_sets = NULL;
+    model->o2_budget = 0;
+    free(model->cm);
+    model->cm = NULL;
+    return;
+}
 
-    for(i = 0; i < 65536; i++) {
-        free(model->o2_models[i]);
+/* fetch the o2 set and models, and the o3 slot, that coding under the given context will
+ * touch, and the o2 frequency of c if the byte to code is already known (c >= 0) */
+static inline void ppm_prefetch(ppm_model_t* model, uint64_t context, int c) {
+    uint16_t word = context & 0xffff;
+    uint32_t index = (uint16_t)(word * model->o2_hash) >> model->o2_shift;
+    uint32_t predctx3 = (context ^ (context >> 2)) & 0x3fffff;
+
+    __builtin_prefetch(&model->o2_sets[index]);
+    __builtin_prefetch(&model->o2_models[index * 2 + 0].m_cum_table);
+    __builtin_prefetch(&model->o2_models[index * 2 + 1].m_cum_table);
+    __builtin_prefetch(&model->o3_predict[predctx3 + (predctx3 >> 1)]);
+    if(c >= 0) {
+        __builtin_prefetch(&model->o2_models[index * 2 + 0].m_frq_table[c]);
+        __builtin_prefetch(&model->o2_models[index * 2 + 1].m_frq_table[c]);
     }
-    memset(model->o2_models, 0, sizeof(model->o2_models));
     return;
 }
 
+/* the next context is known here, so its structures are fetched while the caller goes on
+ * (coding the current symbol's side data, copying a match) before the next ppm symbol */
 void ppm_update_context(ppm_model_t* model, int c) {
     model->context <<= 8;
     model->context |= c;
+    ppm_prefetch(model, model->context, -1);
     return;
 }
 
@@ -100,20 +155,136 @@ static inline void ppm_update_o1(uint8_t* o1, int c) {
 #define M_lastword_ (model->context & 0xffff)
 #define M_lastbyte_ (model->context & 0xff)
 
-int ppm_encode(range_coder_t* coder, ppm_model_t* model, int encode_ch, data_block_t* o_block) {
-    if(!model->o2_models[M_lastword_]) { /* alloc o2-model */
-        model->o2_models[M_lastword_] = malloc(sizeof(o2_model_t));
-        o2_model_init(model->o2_models[M_lastword_]);
+static inline o2_model_t* ppm_o2_lookup(ppm_model_t* model) {
+    uint16_t word = M_lastword_;
+    uint32_t index = (uint16_t)(word * model->o2_hash) >> model->o2_shift;
+    ppm_o2_set_t* set = &model->o2_sets[index];
+    int way;
+
+    for(way = 0; way < 2; way++) {
+        if(set->m_used[way] && set->m_word[way] == word) {
+            set->m_lru = 1 - way;
+            return &model->o2_models[index * 2 + way];
+        }
     }
 
+    /* not found -- take an unused way, or replace the least recently used */
+    way = set->m_used[0] ? set->m_lru : 0;
+    o2_model_init(&model->o2_models[index * 2 + way]);
+    set->m_word[way] = word;
+    set->m_used[way] = 1;
+    set->m_lru = 1 - way;
+    return &model->o2_models[index * 2 + way];
+}
+
+/* o1 coding excludes the predicted byte and every byte the o2 model has seen. the o2
+ * frequency table is that exclusion mask already -- one compare per 16 bytes with SSE2.
+ * sums[c] is the o1 total of included bytes c*16 .. c*16+15 */
+static inline int ppm_o1_sums(o2_model_t* o2, uint8_t* o1, int predict_ch, int sums[16]) {
+    int sum = 0;
+    int c;
+#if defined(__SSE2__)
+    __m128i lanes = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    __m128i predict = _mm_set1_epi8(predict_ch);
+    __m128i zero = _mm_setzero_si128();
+    __m128i included;
+    __m128i frq;
+
+    for(c = 0; c < 16; c++) {
+        included = _mm_andnot_si128(
+                _mm_cmpeq_epi8(_mm_add_epi8(lanes, _mm_set1_epi8(c * 16)), predict),
+                _mm_cmpeq_epi8(_mm_loadu_si128((__m128i*)(o2->m_frq_table + c * 16)), zero));
+        frq = _mm_sad_epu8(_mm_and_si128(_mm_loadu_si128((__m128i*)(o1 + c * 16)), included), zero);
+        sums[c] = (_mm_cvtsi128_si32(frq) + _mm_extract_epi16(frq, 4)) * 8
+            - 7 * __builtin_popcount(_mm_movemask_epi8(included));
+        sum += sums[c];
+    }
+#else
+    int i;
+
+    for(c = 0; c < 16; c++) {
+        sums[c] = 0;
+        for(i = c * 16; i < c * 16 + 16; i++) {
+            if(o2_model_frq(o2, i) == 0 && i != predict_ch) {
+                sums[c] += M_freq_o1(i);
+            }
+        }
+        sum += sums[c];
+    }
+#endif
+    return sum;
+}
+
+/* running o1 totals of included bytes within chunk c, prefix[j] covers bytes c*16 .. c*16+j */
+static inline void ppm_o1_prefix(o2_model_t* o2, uint8_t* o1, int predict_ch, int c, int16_t prefix[16]) {
+#if defined(__SSE2__)
+    __m128i lanes = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    __m128i zero = _mm_setzero_si128();
+    __m128i included;
+    __m128i frq;
+    __m128i lo;
+    __m128i hi;
+
+    included = _mm_andnot_si128(
+            _mm_cmpeq_epi8(_mm_add_epi8(lanes, _mm_set1_epi8(c * 16)), _mm_set1_epi8(predict_ch)),
+            _mm_cmpeq_epi8(_mm_loadu_si128((__m128i*)(o2->m_frq_table + c * 16)), zero));
+    frq = _mm_and_si128(_mm_loadu_si128((__m128i*)(o1 + c * 16)), included);
+
+    /* o1 frequencies as 16-bit lanes, (f*8-7) for included bytes and 0 for others */
+    lo = _mm_sub_epi16(_mm_slli_epi16(_mm_unpacklo_epi8(frq, zero), 3), _mm_and_si128(_mm_unpacklo_epi8(included, zero), _mm_set1_epi16(7)));
+    hi = _mm_sub_epi16(_mm_slli_epi16(_mm_unpackhi_epi8(frq, zero), 3), _mm_and_si128(_mm_unpackhi_epi8(included, zero), _mm_set1_epi16(7)));
+
+    /* prefix sums, 16 * (255*8-7) still fits in int16 */
+    lo = _mm_add_epi16(lo, _mm_slli_si128(lo, 2));
+    hi = _mm_add_epi16(hi, _mm_slli_si128(hi, 2));
+    lo = _mm_add_epi16(lo, _mm_slli_si128(lo, 4));
+    hi = _mm_add_epi16(hi, _mm_slli_si128(hi, 4));
+    lo = _mm_add_epi16(lo, _mm_slli_si128(lo, 8));
+    hi = _mm_add_epi16(hi, _mm_slli_si128(hi, 8));
+    hi = _mm_add_epi16(hi, _mm_set1_epi16(_mm_extract_epi16(lo, 7)));
+    _mm_storeu_si128((__m128i*)(prefix + 0), lo);
+    _mm_storeu_si128((__m128i*)(prefix + 8), hi);
+#else
+    int cum = 0;
+    int i;
+
+    for(i = c * 16; i < c * 16 + 16; i++) {
+        if(o2_model_frq(o2, i) == 0 && i != predict_ch) {
+            cum += M_freq_o1(i);
+        }
+        prefix[i - c * 16] = cum;
+    }
+#endif
+    return;
+}
+
+/* first j in the chunk with prefix[j] > cum */
+static inline int ppm_o1_find(int16_t prefix[16], int cum) {
+#if defined(__SSE2__)
+    __m128i target = _mm_set1_epi16(cum);
+    __m128i lo = _mm_cmpgt_epi16(_mm_loadu_si128((__m128i*)(prefix + 0)), target);
+    __m128i hi = _mm_cmpgt_epi16(_mm_loadu_si128((__m128i*)(prefix + 8)), target);
+
+    return __builtin_ctz(_mm_movemask_epi8(_mm_packs_epi16(lo, hi)) | 0x10000) & 15;
+#else
+    int j;
+
+    for(j = 0; j < 15 && prefix[j] <= cum; j++);
+    return j;
+#endif
+}
+
+static inline void ppm_encode_symbol(range_coder_t* coder, ppm_model_t* model, int encode_ch, data_block_t* o_block) {
     int i;
     int cum = 0;
     int sum = 0;
-    o2_model_t* o2 = model->o2_models[M_lastword_];
+    o2_model_t* o2 = ppm_o2_lookup(model);
     uint8_t*    o1 = model->o1_models[M_lastbyte_];
     int predict_ch = M_predbyte_;
     int predict_frq = o2_model_frq(o2, predict_ch);
     int rescaled;
+    int sums[16];
+    int16_t prefix[16];
 
     if(encode_ch == predict_ch) { /* short predictor matched */
         range_encoder_encode(coder,
@@ -146,13 +317,13 @@ int ppm_encode(range_coder_t* coder, ppm_model_t* model, int encode_ch, data_blo
             rescaled = o2_model_update(o2, 257, 1);
 
             if(o1[encode_ch] > 0) {
-                /* encode with o1_model, exclude predict_ch and all bytes those appeared in model->o2_models */
-                for(i = 0; i < 256; i++) {
-                    if(o2_model_frq(o2, i) == 0 && i != predict_ch) {
-                        cum += M_freq_o1(i) & -(i < encode_ch);
-                        sum += M_freq_o1(i);
-                    }
+                /* encode with o1_model, exclude predict_ch and all bytes those appeared in the o2 model */
+                sum = ppm_o1_sums(o2, o1, predict_ch, sums);
+                for(i = 0; i < encode_ch / 16; i++) {
+                    cum += sums[i];
                 }
+                ppm_o1_prefix(o2, o1, predict_ch, encode_ch / 16, prefix);
+                cum += prefix[encode_ch % 16] - M_freq_o1(encode_ch);
                 range_encoder_encode(coder, cum, M_freq_o1(encode_ch), sum, o_block);
                 ppm_update_o1(o1, encode_ch);
             }
@@ -163,26 +334,65 @@ int ppm_encode(range_coder_t* coder, ppm_model_t* model, int encode_ch, data_blo
         }
         ppm_update_o3(model, encode_ch);
     }
+    return;
+}
+
+int ppm_encode(range_coder_t* coder, ppm_model_t* model, int encode_ch, data_block_t* o_block) {
+    ppm_prefetch(model, (model->context << 8) | encode_ch, -1);
+    ppm_encode_symbol(coder, model, encode_ch, o_block);
     return 0;
 }
 
-int ppm_decode(range_coder_t* coder, ppm_model_t* model, uint8_t** input) {
-    if(!model->o2_models[M_lastword_]) { /* alloc o2-model */
-        model->o2_models[M_lastword_] = malloc(sizeof(o2_model_t));
-        o2_model_init(model->o2_models[M_lastword_]);
+#define M_run_prefetch 2 /* a run knows its upcoming bytes, so prefetches this far ahead */
+
+void ppm_encode_run(range_coder_t* coder, ppm_model_t* model, uint8_t* data, int len, data_block_t* o_block) {
+    uint64_t context = model->context;
+    int i;
+
+    for(i = 0; i < M_run_prefetch && i < len; i++) {
+        context = (context << 8) | data[i];
+    }
+    for(i = 0; i < len; i++) {
+        if(i + M_run_prefetch < len) {
+            ppm_prefetch(model, context, data[i + M_run_prefetch]);
+            context = (context << 8) | data[i + M_run_prefetch];
+        }
+        ppm_encode_symbol(coder, model, data[i], o_block);
+        model->context = (model->context << 8) | data[i]; /* already prefetched */
+    }
+    return;
+}
+
+int ppm_incompressible(uint8_t* data, uint32_t size) {
+    uint32_t counter[256] = {0};
+    double bits = 0;
+    uint32_t i;
+
+    for(i = 0; i < size; i++) {
+        counter[data[i]]++;
     }
+    for(i = 0; i < 256; i++) {
+        if(counter[i] > 0) {
+            bits += counter[i] * log2((double)size / counter[i]);
+        }
+    }
+    return bits >= size * 7.99;
+}
 
+int ppm_decode(range_coder_t* coder, ppm_model_t* model, uint8_t** input) {
     decode_symbol_t decode_helper;
     int decode_cum;
     int i;
     int decode_symbol;
     int sum = 0;
     int cum = 0;
-    o2_model_t* o2 = model->o2_models[M_lastword_];
+    o2_model_t* o2 = ppm_o2_lookup(model);
     uint8_t*    o1 = model->o1_models[M_lastbyte_];
     int predict_ch = M_predbyte_;
     int predict_frq = o2_model_frq(o2, predict_ch);
     int rescaled;
+    int sums[16];
+    int16_t prefix[16];
 
     /* decode with o2_model */
     decode_cum = range_decoder_decode_cum(coder, o2_model_sum(o2) - predict_frq);
@@ -192,8 +402,11 @@ int ppm_decode(range_coder_t* coder, ppm_model_t* model, uint8_t** input) {
             o2_model_frq(o2, decode_helper.m_sym),
             o2_model_sum(o2),
             input);
-    rescaled = o2_model_update(o2, decode_helper.m_sym, 1);
     decode_symbol = decode_helper.m_sym;
+    if(decode_symbol <= 256) { /* the next context is known, fetch it while updating this one */
+        ppm_prefetch(model, (model->context << 8) | (decode_symbol == 256 ? predict_ch : decode_symbol), -1);
+    }
+    rescaled = o2_model_update(o2, decode_helper.m_sym, 1);
 
     if(decode_symbol == 256) { /* short predictor matched */
         decode_symbol = predict_ch;
@@ -205,24 +418,21 @@ int ppm_decode(range_coder_t* coder, ppm_model_t* model, uint8_t** input) {
         }
         ppm_update_o3(model, decode_symbol);
 
-    } else if(decode_symbol == 257) { /* decode with o1_model, exclude predict_ch and all bytes in model->o2_models */
-        for(i = 0; i < 256; i++) {
-            if(o2_model_frq(o2, i) == 0 && i != predict_ch) {
-                sum += M_freq_o1(i);
-            }
+    } else if(decode_symbol == 257) { /* decode with o1_model, exclude predict_ch and all bytes in the o2 model */
+        sum = ppm_o1_sums(o2, o1, predict_ch, sums);
+        if(sum == 0) { /* every symbol excluded -- only in corrupted input */
+            return predict_ch;
         }
         decode_cum = range_decoder_decode_cum(coder, sum);
 
-        /* decode with o1 model */
-        for(i = 0; i < 256; i++) {
-            if(o2_model_frq(o2, i) == 0 && i != predict_ch) {
-                if(cum + M_freq_o1(i) > decode_cum) {
-                    decode_symbol = i;
-                    break;
-                }
-                cum += M_freq_o1(i);
-            }
+        /* decode with o1 model -- find the chunk, then the symbol in it */
+        for(i = 0; cum + sums[i] <= decode_cum; i++) {
+            cum += sums[i];
         }
+        ppm_o1_prefix(o2, o1, predict_ch, i, prefix);
+        decode_symbol = i * 16 + ppm_o1_find(prefix, decode_cum - cum);
+        ppm_prefetch(model, (model->context << 8) | decode_symbol, -1);
+        cum += prefix[decode_symbol % 16] - M_freq_o1(decode_symbol);
         range_decoder_decode(coder, cum, M_freq_o1(decode_symbol), sum, input);
         ppm_update_o1(o1, decode_symbol);
 
@@ -233,3 +443,389 @@ int ppm_decode(range_coder_t* coder, ppm_model_t* model, uint8_t** input) {
     }
     return decode_symbol;
 }
+
+/* context mixing -- probabilities are P(bit=1), 12 bits at the mixer and the coder.
+ * stretch(p) = ln(p/(1-p)) and squash() is its inverse, both scaled by 256 */
+#define M_cm_hash_bits  22
+#define M_cm_inputs     6 /* o1, o2, o4, o6, o3 predicted byte, bias */
+#define M_cm_limit      10 /* context counters adapt at 1/(n+1.5) after n hits, down to this */
+#define M_cm_pred_rate  5
+#define M_cm_apm_rate   7
+#define M_cm_mixer_rate 10
+#define M_cm_mixer_sets 5 /* no prediction, or predicted byte matching at 4 confidences */
+
+typedef struct ppm_cm_t {
+    uint16_t o1[256][256]; /* context counters, 12-bit probability and 4-bit hit count */
+    uint16_t oh[3][1 << M_cm_hash_bits]; /* o2, o4, o6 -- 16 slots per context and nibble */
+    uint16_t pred[16][2]; /* [o3 confidence][predicted bit], 16-bit probability */
+    int32_t  mixer[M_cm_mixer_sets][256][M_cm_inputs];
+    uint16_t apm[65536][33]; /* [previous byte, bit tree node][stretch(p) bucket], 16-bit probability */
+    int16_t  stretch[4096];
+    int16_t  squash[4096]; /* squash(d - 2048) */
+    int32_t  rates[16];
+} ppm_cm_t;
+
+/* state for coding one byte */
+typedef struct cm_coding_t {
+    ppm_cm_t* m_cm;
+    uint32_t  m_hash[3];
+    uint32_t  m_base[3];
+    int       m_node;
+    int       m_nib;
+    int       m_bits;
+    int       m_c1;
+    int       m_predict_ch;
+    int       m_predict_frq;
+    int       m_st[M_cm_inputs];
+    uint16_t* m_counters[5];
+    int32_t*  m_w;
+    uint16_t* m_apm;
+    int       m_apm_pos;
+    int       m_pm;
+} cm_coding_t;
+
+/* squash() at every 128th step of d, from -2048 to 2048 -- 4096 / (1 + e^(-d/256)), rounded */
+static const int16_t cm_squash_points[33] = {
+    1, 2, 4, 6, 10, 17, 27, 45, 74, 120, 194, 311, 488, 747, 1102, 1546,
+    2048, 2550, 2994, 3349, 3608, 3785, 3902, 3976, 4022, 4051, 4069, 4079, 4086, 4090, 4092, 4094,
+    4095,
+};
+
+/* fixed tables -- built in integers only, so every build codes the same bitstream */
+static void ppm_cm_tables(ppm_cm_t* cm) {
+    int i;
+    int j;
+    int k;
+    int p;
+
+    for(i = 0; i < 4096; i++) { /* interpolate between the points */
+        j = i >> 7;
+        k = i & 127;
+        cm->squash[i] = (cm_squash_points[j] * (128 - k) + cm_squash_points[j + 1] * k + 64) >> 7;
+    }
+    for(i = 0, p = 0; i < 4096; i++) { /* inverse of squash */
+        for(; p <= cm->squash[i]; p++) {
+            cm->stretch[p] = i - 2048;
+        }
+    }
+    for(; p < 4096; p++) {
+        cm->stretch[p] = 2047;
+    }
+    for(i = 0; i < 16; i++) {
+        cm->rates[i] = 131072 / (2 * i + 3); /* 65536 / (i + 1.5) */
+    }
+    return;
+}
+
+static ppm_cm_t* ppm_cm_create() {
+    ppm_cm_t* cm = malloc(sizeof(ppm_cm_t));
+    int i;
+    int j;
+    int k;
+
+    if(cm == NULL) {
+        return NULL;
+    }
+    ppm_cm_tables(cm);
+    for(i = 0; i < 256; i++) {
+        for(j = 0; j < 256; j++) {
+            cm->o1[i][j] = 32768;
+        }
+    }
+    for(i = 0; i < 3; i++) {
+        for(j = 0; j < (1 << M_cm_hash_bits); j++) {
+            cm->oh[i][j] = 32768;
+        }
+    }
+    for(i = 0; i < 16; i++) {
+        cm->pred[i][0] = 16384;
+        cm->pred[i][1] = 49152;
+    }
+    for(i = 0; i < M_cm_mixer_sets; i++) {
+        for(j = 0; j < 256; j++) {
+            for(k = 0; k < M_cm_inputs; k++) {
+                cm->mixer[i][j][k] = 1 << 14;
+            }
+        }
+    }
+    for(i = 0; i < 65536; i++) {
+        for(j = 0; j < 33; j++) {
+            cm->apm[i][j] = cm->squash[(j - 16) * 128 + 2048 - (j == 32)] * 16;
+        }
+    }
+    return cm;
+}
+
+static inline uint32_t cm_hash(uint64_t x, int n) {
+    x = (x + n) * 0x9e3779b97f4a7c15ull;
+    return (uint32_t)(x >> 32) ^ (uint32_t)x;
+}
+
+/* counters for the 15 nodes of the current nibble */
+static inline void cm_nibble(cm_coding_t* s) {
+    int k;
+
+    for(k = 0; k < 3; k++) {
+        s->m_base[k] = (cm_hash(s->m_hash[k], s->m_node) >> (32 - M_cm_hash_bits)) & ~15;
+    }
+    s->m_nib = 1;
+    return;
+}
+
+int ppm_cm_setup(ppm_model_t* model) {
+    if(!model->cm) {
+        model->cm = ppm_cm_create();
+    }
+    return (model->cm != NULL) ? 0 : -1;
+}
+
+static inline void cm_begin(cm_coding_t* s, ppm_model_t* model) {
+    s->m_cm = model->cm;
+    s->m_hash[0] = cm_hash(model->context & 0xffff, 2);
+    s->m_hash[1] = cm_hash(model->context & 0xffffffff, 4);
+    s->m_hash[2] = cm_hash(model->context & 0xffffffffffffull, 6);
+    s->m_c1 = model->context & 0xff;
+    s->m_predict_ch = M_predbyte_;
+    s->m_predict_frq = (model->o3_predict[M_predbase_ + 1 + (~M_predctx3_ & 1)] >> (4 * (~M_predctx3_ & 1))) & 0x0f;
+    s->m_node = 1;
+    s->m_bits = 0;
+    cm_nibble(s);
+    return;
+}
+
+/* P(bit=1) of the next bit, 12 bits */
+static inline int cm_predict(cm_coding_t* s) {
+    ppm_cm_t* cm = s->m_cm;
+    int64_t dot = 0;
+    int mixer_set = 0;
+    int predict_bit;
+    int pa;
+    int p;
+    int i;
+
+    s->m_counters[0] = &cm->o1[s->m_c1][s->m_node];
+    s->m_counters[1] = &cm->oh[0][s->m_base[0] + s->m_nib];
+    s->m_counters[2] = &cm->oh[1][s->m_base[1] + s->m_nib];
+    s->m_counters[3] = &cm->oh[2][s->m_base[2] + s->m_nib];
+    s->m_counters[4] = NULL;
+    for(i = 0; i < 4; i++) {
+        s->m_st[i] = cm->stretch[*s->m_counters[i] >> 4];
+    }
+
+    s->m_st[4] = 0;
+    if(s->m_predict_frq > 0 && ((s->m_predict_ch | 256) >> (8 - s->m_bits)) == s->m_node) { /* prediction still matching */
+        predict_bit = (s->m_predict_ch >> (7 - s->m_bits)) & 1;
+        s->m_counters[4] = &cm->pred[s->m_predict_frq][predict_bit];
+        s->m_st[4] = cm->stretch[*s->m_counters[4] >> 4];
+        mixer_set = 1 + (s->m_predict_frq > 1) + (s->m_predict_frq > 3) + (s->m_predict_frq > 7);
+    }
+    s->m_st[5] = 256;
+
+    s->m_w = cm->mixer[mixer_set][s->m_node];
+    for(i = 0; i < M_cm_inputs; i++) {
+        dot += (int64_t)s->m_w[i] * s->m_st[i];
+    }
+    dot >>= 16;
+    dot = (dot < -2047) ? -2047 : (dot > 2047) ? 2047 : dot;
+    s->m_pm = cm->squash[dot + 2048];
+
+    /* refine by the order-1 apm, interpolating between two buckets */
+    s->m_apm = cm->apm[s->m_c1 << 8 | s->m_node];
+    i = cm->stretch[s->m_pm] + 2048;
+    pa = (s->m_apm[i >> 7] * (128 - (i & 127)) + s->m_apm[(i >> 7) + 1] * (i & 127)) >> 11;
+    s->m_apm_pos = (i + 64) >> 7;
+
+    p = (s->m_pm + pa * 3) >> 2;
+    return (p < 1) ? 1 : (p > 4095) ? 4095 : p;
+}
+
+static inline void cm_counter_update(uint16_t* counter, int bit, int rate) {
+    if(bit) {
+        *counter += (65536 - *counter) >> rate;
+    } else {
+        *counter -= *counter >> rate;
+    }
+    return;
+}
+
+static inline void cm_context_update(ppm_cm_t* cm, uint16_t* counter, int bit) {
+    int n = *counter & 15;
+    int p = *counter >> 4;
+
+    p += (((bit << 12) - p) * cm->rates[n]) >> 16;
+    *counter = p << 4 | (n + (n < M_cm_limit));
+    return;
+}
+
+static inline void cm_update(cm_coding_t* s, int bit) {
+    int err = (bit << 12) - s->m_pm;
+    int i;
+
+    for(i = 0; i < M_cm_inputs; i++) {
+        s->m_w[i] += (s->m_st[i] * err) >> M_cm_mixer_rate;
+    }
+    for(i = 0; i < 4; i++) {
+        cm_context_update(s->m_cm, s->m_counters[i], bit);
+    }
+    if(s->m_counters[4]) {
+        cm_counter_update(s->m_counters[4], bit, M_cm_pred_rate);
+    }
+    cm_counter_update(&s->m_apm[s->m_apm_pos], bit, M_cm_apm_rate);
+
+    s->m_node = s->m_node * 2 + bit;
+    s->m_nib = s->m_nib * 2 + bit;
+    s->m_bits += 1;
+    if(s->m_nib >= 16) {
+        cm_nibble(s);
+    }
+    return;
+}
+
+static inline void cm_finish(cm_coding_t* s, ppm_model_t* model) {
+    ppm_update_o3(model, (s->m_node - 256 == s->m_predict_ch) ? -1 : s->m_node - 256);
+    return;
+}
+
+int ppm_cm_encode(range_coder_t* coder, ppm_model_t* model, int encode_ch, data_block_t* o_block) {
+    cm_coding_t s;
+    int bit;
+    int i;
+
+    cm_begin(&s, model);
+    for(i = 7; i >= 0; i--) {
+        bit = (encode_ch >> i) & 1;
+        range_encoder_encode_bit(coder, 4096 - cm_predict(&s), 12, bit, o_block);
+        cm_update(&s, bit);
+    }
+    cm_finish(&s, model);
+    return 0;
+}
+
+int ppm_cm_decode(range_coder_t* coder, ppm_model_t* model, uint8_t** input) {
+    cm_coding_t s;
+    int bit;
+
+    cm_begin(&s, model);
+    while(s.m_node < 256) {
+        bit = range_decoder_decode_bit(coder, 4096 - cm_predict(&s), 12, input);
+        cm_update(&s, bit);
+    }
+    cm_finish(&s, model);
+    return s.m_node - 256;
+}
+
+/* trained tables are mostly zero -- store them as (zeros, n, n bytes) runs */
+static void ppm_snapshot_write_sparse(data_block_t* snapshot, uint8_t* table, uint32_t size) {
+    uint32_t pos = 0;
+    uint32_t zeros;
+    uint32_t n;
+    uint32_t k;
+
+    while(pos < size) {
+        for(zeros = 0; pos + zeros < size && table[pos + zeros] == 0; zeros++);
+        for(n = 0, k = 0; pos + zeros + n < size && k < 16; n++) { /* end at 16 zeros in a row */
+            k = (table[pos + zeros + n] == 0) ? k + 1 : 0;
+        }
+        n -= k;
+        data_block_append(snapshot, &zeros, sizeof(zeros));
+        data_block_append(snapshot, &n, sizeof(n));
+        data_block_append(snapshot, table + pos + zeros, n);
+        pos += zeros + n;
+    }
+    return;
+}
+
+/* snapshot of a trained model -- o1 models, the o2 set tags and the models of used ways,
+ * the o3 predictor and the context, then the context mixing tables if they were used.
+ * the set tags, the o3 predictor and the mixing tables are sparse */
+void ppm_model_save(ppm_model_t* model, data_block_t* snapshot) {
+    uint32_t nset = (model->o2_sets != NULL) ? 1u << (16 - model->o2_shift) : 0;
+    uint32_t i;
+    uint8_t  has_cm = (model->cm != NULL);
+
+    data_block_append(snapshot, model->o1_models, sizeof(model->o1_models));
+    data_block_append(snapshot, &model->o2_budget, sizeof(model->o2_budget));
+    ppm_snapshot_write_sparse(snapshot, (uint8_t*)model->o2_sets, nset * sizeof(ppm_o2_set_t));
+    for(i = 0; i < nset * 2; i++) {
+        if(model->o2_sets[i / 2].m_used[i % 2]) {
+            data_block_append(snapshot, &model->o2_models[i], sizeof(o2_model_t));
+        }
+    }
+    ppm_snapshot_write_sparse(snapshot, model->o3_predict, sizeof(model->o3_predict));
+    data_block_append(snapshot, &model->context, sizeof(model->context));
+    data_block_append(snapshot, &has_cm, sizeof(has_cm));
+    if(has_cm) {
+        ppm_snapshot_write_sparse(snapshot, (uint8_t*)model->cm, sizeof(ppm_cm_t));
+    }
+    return;
+}
+
+static inline int ppm_snapshot_read(void* dst, uint64_t size, uint8_t** data, uint8_t* end) {
+    if((uint64_t)(end - *data) < size) {
+        return -1;
+    }
+    memcpy(dst, *data, size);
+    *data += size;
+    return 0;
+}
+
+static int ppm_snapshot_read_sparse(uint8_t* table, uint32_t size, uint8_t** data, uint8_t* end) {
+    uint32_t pos = 0;
+    uint32_t zeros;
+    uint32_t n;
+
+    while(pos < size) {
+        if(ppm_snapshot_read(&zeros, sizeof(zeros), data, end) != 0
+                || ppm_snapshot_read(&n, sizeof(n), data, end) != 0
+                || zeros > size - pos
+                || n > size - pos - zeros) {
+            return -1;
+        }
+        memset(table + pos, 0, zeros);
+        if(ppm_snapshot_read(table + pos + zeros, n, data, end) != 0) {
+            return -1;
+        }
+        pos += zeros + n;
+    }
+    return 0;
+}
+
+int ppm_model_load(ppm_model_t* model, uint8_t** data, uint8_t* end) {
+    uint32_t nset;
+    uint32_t o2_budget;
+    uint32_t i;
+    uint8_t  has_cm;
+
+    if(ppm_snapshot_read(model->o1_models, sizeof(model->o1_models), data, end) != 0
+            || ppm_snapshot_read(&o2_budget, sizeof(o2_budget), data, end) != 0
+            || ppm_model_setup(model, o2_budget) != 0) {
+        return -1;
+    }
+    nset = 1u << (16 - model->o2_shift);
+    if(ppm_snapshot_read_sparse((uint8_t*)model->o2_sets, nset * sizeof(ppm_o2_set_t), data, end) != 0) {
+        return -1;
+    }
+    for(i = 0; i < nset; i++) { /* ways index the models, keep them in range */
+        model->o2_sets[i].m_used[0] = !!model->o2_sets[i].m_used[0];
+        model->o2_sets[i].m_used[1] = !!model->o2_sets[i].m_used[1];
+        model->o2_sets[i].m_lru &= 1;
+    }
+    for(i = 0; i < nset * 2; i++) {
+        if(model->o2_sets[i / 2].m_used[i % 2] && ppm_snapshot_read(&model->o2_models[i], sizeof(o2_model_t), data, end) != 0) {
+            return -1;
+        }
+    }
+    if(ppm_snapshot_read_sparse(model->o3_predict, sizeof(model->o3_predict), data, end) != 0
+            || ppm_snapshot_read(&model->context, sizeof(model->context), data, end) != 0
+            || ppm_snapshot_read(&has_cm, sizeof(has_cm), data, end) != 0) {
+        return -1;
+    }
+    if(has_cm) {
+        if(ppm_cm_setup(model) != 0
+                || ppm_snapshot_read_sparse((uint8_t*)model->cm, sizeof(ppm_cm_t), data, end) != 0) {
+            return -1;
+        }
+        ppm_cm_tables(model->cm); /* fixed, whatever the snapshot holds */
+    }
+    return 0;
+}
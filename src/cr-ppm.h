@@ -33,18 +33,61 @@
 #include "cr-datablock.h"
 #include "cr-o2model.h"
 
+struct ppm_cm_t;
+
+/* o2 contexts live in one arena of 2-way sets -- the set tags first, then the models,
+ * which are only touched once used. the default budget holds every o2 context, indexed
+ * by the last two bytes so contexts sharing the older byte stay on the same pages. a
+ * smaller budget (set by -P and stored per block) indexes by a hash and replaces the
+ * least recently used way of a set */
+typedef struct ppm_o2_set_t {
+    uint16_t m_word[2]; /* last two bytes */
+    uint8_t  m_used[2];
+    uint8_t  m_lru;     /* the way to replace next */
+} ppm_o2_set_t;
+
+#define PPM_O2_MIN_BUDGET 1     /* KB, holds one set */
+#define PPM_O2_MAX_BUDGET 17920 /* KB, holds every o2 context */
+
 typedef struct ppm_model_t {
     uint8_t     o1_models[256][256];
-    o2_model_t* o2_models[65536];
+    ppm_o2_set_t* o2_sets;
+    o2_model_t* o2_models; /* in the o2_sets allocation */
+    uint32_t    o2_hash;  /* set index is the top bits of (last two bytes * o2_hash) */
+    uint32_t    o2_shift;
+    uint32_t    o2_budget; /* KB */
     uint8_t     o3_predict[6291456]; /* 1.5*(1<<22) */
-    uint32_t    context;
+    uint64_t    context;
+    struct ppm_cm_t* cm; /* context mixing tables, allocated on first use */
 } ppm_model_t;
 
+/* o2 budget (KB) for new blocks, set by the -P switch */
+extern int ppm_o2_budget;
+
 void ppm_model_init(ppm_model_t* model);
 void ppm_model_free(ppm_model_t* model);
+int  ppm_model_setup(ppm_model_t* model, int o2_budget); /* resize the o2 arena unless it has that budget, its contexts start over. -1 without memory */
 void ppm_update_context(ppm_model_t* model, int c);
 
+/* warm start -- append a trained model to a snapshot, or read it back into an initialized
+ * model (taking the o2 budget of the snapshot), advancing *data. load returns -1 on a
+ * truncated snapshot */
+void ppm_model_save(ppm_model_t* model, data_block_t* snapshot);
+int  ppm_model_load(ppm_model_t* model, uint8_t** data, uint8_t* end);
+
 int ppm_encode(range_coder_t* coder, ppm_model_t* model, int encode_ch, data_block_t* o_block);
 int ppm_decode(range_coder_t* coder, ppm_model_t* model, uint8_t** input);
 
+/* codes len literal bytes as ppm_encode() + ppm_update_context() each would */
+void ppm_encode_run(range_coder_t* coder, ppm_model_t* model, uint8_t* data, int len, data_block_t* o_block);
+
+/* order-0 entropy of the data is within 0.01 bits of 8 -- literals coded from it will not shrink */
+int ppm_incompressible(uint8_t* data, uint32_t size);
+
+/* high ratio mode -- codes bytes bitwise, mixing o1, o2, o4, o6 and the o3 predicted
+ * byte in a logistic mixer refined by an APM. slower and larger (~30MB) than ppm */
+int ppm_cm_setup(ppm_model_t* model); /* allocate the tables unless done, -1 without memory */
+int ppm_cm_encode(range_coder_t* coder, ppm_model_t* model, int encode_ch, data_block_t* o_block);
+int ppm_cm_decode(range_coder_t* coder, ppm_model_t* model, uint8_t** input);
+
 #endif
@@ -0,0 +1,303 @@
+/*
+ * Copyright (C) 2011-2012 by Zhang Li <RichSelian at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE PROJECT AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE PROJECT OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "cr-ppmh.h"
+
+int ppmh_order = 4;
+int ppmh_budget = 64;
+
+typedef struct ppmh_symbol_t {
+    uint8_t m_sym;
+    uint8_t m_frq;
+} ppmh_symbol_t;
+
+/* a context, followed by m_cap symbols */
+typedef struct ppmh_node_t {
+    uint32_t m_check;
+    uint16_t m_sum;
+    uint16_t m_num;
+    uint16_t m_cap;
+    uint16_t m_reserved;
+} ppmh_node_t;
+
+#define M_symbols(node)     ((ppmh_symbol_t*)((node) + 1))
+#define M_node_size(cap)    ((sizeof(ppmh_node_t) + sizeof(ppmh_symbol_t) * (cap) + 3) & ~3u)
+#define M_byte_room         ((PPMH_MAX_ORDER + 1) * M_node_size(256)) /* a byte grows at most one node per order */
+#define M_frq_increment     3
+#define M_frq_limit         250
+
+int ppmh_model_setup(ppmh_model_t* model, int order, int budget) {
+    uint64_t size = (uint64_t)budget << 20;
+
+    if(model->m_arena && model->m_order == order && model->m_budget == budget) {
+        return 0;
+    }
+    ppmh_model_free(model);
+
+    /* an eighth of the budget for the hash table */
+    for(model->m_table_bits = 10; (sizeof(uint32_t) << (model->m_table_bits + 1)) <= size / 8; model->m_table_bits++);
+    model->m_arena_size = size - (sizeof(uint32_t) << model->m_table_bits);
+    model->m_arena = malloc(model->m_arena_size);
+    model->m_table = malloc(sizeof(uint32_t) << model->m_table_bits);
+    if(!model->m_arena || !model->m_table) {
+        ppmh_model_free(model);
+        return -1;
+    }
+    model->m_order = order;
+    model->m_budget = budget;
+    ppmh_model_restart(model);
+    return 0;
+}
+
+void ppmh_model_restart(ppmh_model_t* model) {
+    if(model->m_arena) {
+        memset(model->m_table, 0, sizeof(uint32_t) << model->m_table_bits);
+        memset(model->m_excluded, 0, sizeof(model->m_excluded));
+        model->m_arena_used = sizeof(uint32_t); /* offset 0 is no node */
+        model->m_stamp = 0;
+    }
+    return;
+}
+
+void ppmh_model_free(ppmh_model_t* model) {
+    free(model->m_arena);
+    free(model->m_table);
+    memset(model, 0, sizeof(ppmh_model_t));
+    return;
+}
+
+static inline uint64_t ppmh_hash(uint64_t context, int order) {
+    uint64_t h = (order > 0) ? context & (~0ull >> (64 - 8 * order)) : 0;
+
+    h = (h | (uint64_t)order << 56) * 0x9e3779b97f4a7c15ull;
+    h = (h ^ (h >> 29)) * 0xbf58476d1ce4e5b9ull;
+    return h ^ (h >> 32);
+}
+
+static inline ppmh_node_t* ppmh_find(ppmh_model_t* model, uint64_t h) {
+    uint32_t offset = model->m_table[h >> (64 - model->m_table_bits)];
+    ppmh_node_t* node = (ppmh_node_t*)(model->m_arena + offset);
+
+    return (offset && node->m_check == (uint32_t)h) ? node : NULL;
+}
+
+/* add a symbol, moving the node to a twice larger one when it is full */
+static ppmh_node_t* ppmh_add(ppmh_model_t* model, uint64_t h, ppmh_node_t* node, int c) {
+    ppmh_node_t* grown;
+
+    if(!node || node->m_num == node->m_cap) {
+        grown = (ppmh_node_t*)(model->m_arena + model->m_arena_used);
+        if(node) {
+            memcpy(grown, node, M_node_size(node->m_cap));
+            grown->m_cap = node->m_cap * 2;
+        } else {
+            grown->m_check = h;
+            grown->m_sum = 0;
+            grown->m_num = 0;
+            grown->m_cap = 2;
+        }
+        model->m_table[h >> (64 - model->m_table_bits)] = model->m_arena_used;
+        model->m_arena_used += M_node_size(grown->m_cap);
+        node = grown;
+    }
+    M_symbols(node)[node->m_num].m_sym = c;
+    M_symbols(node)[node->m_num].m_frq = 1;
+    node->m_num += 1;
+    node->m_sum += 1;
+    return node;
+}
+
+/* look up the contexts of a new byte, restarting the model when the arena may run out */
+static inline void ppmh_begin(ppmh_model_t* model, uint64_t context, uint64_t* hashes, ppmh_node_t** nodes) {
+    int k;
+
+    if(model->m_arena_size - model->m_arena_used < M_byte_room) {
+        ppmh_model_restart(model);
+    }
+    model->m_stamp += 1;
+    if(model->m_stamp == 0) { /* wrapped -- old exclusions would match again */
+        memset(model->m_excluded, 0, sizeof(model->m_excluded));
+        model->m_stamp = 1;
+    }
+    for(k = 0; k <= model->m_order; k++) {
+        hashes[k] = ppmh_hash(context, k);
+        nodes[k] = ppmh_find(model, hashes[k]);
+    }
+    return;
+}
+
+/* the symbol was coded in order k (at index i of its node), or -1 -- count it there and
+ * add it to every higher order */
+static inline void ppmh_update(ppmh_model_t* model, uint64_t* hashes, ppmh_node_t** nodes, int k, int i, int c) {
+    ppmh_symbol_t* symbols;
+    int j;
+
+    if(k >= 0) {
+        symbols = M_symbols(nodes[k]);
+        symbols[i].m_frq += M_frq_increment;
+        nodes[k]->m_sum += M_frq_increment;
+
+        if(symbols[i].m_frq > M_frq_limit) {
+            nodes[k]->m_sum = 0;
+            for(j = 0; j < nodes[k]->m_num; j++) {
+                symbols[j].m_frq = (symbols[j].m_frq + 1) / 2;
+                nodes[k]->m_sum += symbols[j].m_frq;
+            }
+        }
+    }
+    for(j = k + 1; j <= model->m_order; j++) {
+        nodes[j] = ppmh_add(model, hashes[j], nodes[j], c);
+    }
+    return;
+}
+
+/* sum and number of the symbols not excluded yet */
+static inline int ppmh_count(ppmh_model_t* model, ppmh_node_t* node, int* num) {
+    ppmh_symbol_t* symbols = M_symbols(node);
+    int sum = 0;
+    int i;
+
+    *num = 0;
+    for(i = 0; i < node->m_num; i++) {
+        if(model->m_excluded[symbols[i].m_sym] != model->m_stamp) {
+            sum += symbols[i].m_frq;
+            *num += 1;
+        }
+    }
+    return sum;
+}
+
+static inline void ppmh_exclude(ppmh_model_t* model, ppmh_node_t* node) {
+    int i;
+
+    for(i = 0; i < node->m_num; i++) {
+        model->m_excluded[M_symbols(node)[i].m_sym] = model->m_stamp;
+    }
+    return;
+}
+
+void ppmh_encode(range_coder_t* coder, ppmh_model_t* model, uint64_t context, int encode_ch, data_block_t* o_block) {
+    uint64_t hashes[PPMH_MAX_ORDER + 1];
+    ppmh_node_t* nodes[PPMH_MAX_ORDER + 1];
+    ppmh_symbol_t* symbols;
+    int k;
+    int i = 0;
+    int sum;
+    int num;
+    int cum;
+
+    ppmh_begin(model, context, hashes, nodes);
+    for(k = model->m_order; k >= 0; k--) {
+        if(!nodes[k] || (sum = ppmh_count(model, nodes[k], &num)) == 0) {
+            continue;
+        }
+        symbols = M_symbols(nodes[k]);
+        for(cum = 0, i = 0; i < nodes[k]->m_num && symbols[i].m_sym != encode_ch; i++) {
+            cum += symbols[i].m_frq & -(model->m_excluded[symbols[i].m_sym] != model->m_stamp);
+        }
+        if(i < nodes[k]->m_num) {
+            range_encoder_encode(coder, cum, symbols[i].m_frq, sum + num, o_block);
+            break;
+        }
+        range_encoder_encode(coder, sum, num, sum + num, o_block); /* escape, escape frequency is the number of symbols */
+        ppmh_exclude(model, nodes[k]);
+    }
+
+    if(k < 0) { /* order -1 */
+        for(cum = 0, num = 0, i = 0; i < 256; i++) {
+            if(model->m_excluded[i] != model->m_stamp) {
+                cum += (i < encode_ch);
+                num += 1;
+            }
+        }
+        range_encoder_encode(coder, cum, 1, num, o_block);
+    }
+    ppmh_update(model, hashes, nodes, k, i, encode_ch);
+    return;
+}
+
+int ppmh_decode(range_coder_t* coder, ppmh_model_t* model, uint64_t context, uint8_t** input) {
+    uint64_t hashes[PPMH_MAX_ORDER + 1];
+    ppmh_node_t* nodes[PPMH_MAX_ORDER + 1];
+    ppmh_symbol_t* symbols;
+    int k;
+    int i = 0;
+    int sum;
+    int num;
+    int cum;
+    int decode_cum;
+    int decode_ch = 0;
+
+    ppmh_begin(model, context, hashes, nodes);
+    for(k = model->m_order; k >= 0; k--) {
+        if(!nodes[k] || (sum = ppmh_count(model, nodes[k], &num)) == 0) {
+            continue;
+        }
+        decode_cum = range_decoder_decode_cum(coder, sum + num);
+        if(decode_cum >= sum) { /* escape */
+            range_decoder_decode(coder, sum, num, sum + num, input);
+            ppmh_exclude(model, nodes[k]);
+            continue;
+        }
+        symbols = M_symbols(nodes[k]);
+        for(cum = 0, i = 0; i < nodes[k]->m_num; i++) {
+            if(model->m_excluded[symbols[i].m_sym] != model->m_stamp) {
+                if(cum + symbols[i].m_frq > decode_cum) {
+                    break;
+                }
+                cum += symbols[i].m_frq;
+            }
+        }
+        decode_ch = symbols[i].m_sym;
+        range_decoder_decode(coder, cum, symbols[i].m_frq, sum + num, input);
+        break;
+    }
+
+    if(k < 0) { /* order -1 */
+        for(num = 0, i = 0; i < 256; i++) {
+            num += (model->m_excluded[i] != model->m_stamp);
+        }
+        if(num == 0) { /* every symbol excluded -- only in corrupted input */
+            return 0;
+        }
+        decode_cum = range_decoder_decode_cum(coder, num);
+        for(cum = 0, decode_ch = 0; ; decode_ch++) {
+            if(model->m_excluded[decode_ch] != model->m_stamp) {
+                if(cum == decode_cum) {
+                    break;
+                }
+                cum += 1;
+            }
+        }
+        range_decoder_decode(coder, cum, 1, num, input);
+    }
+    ppmh_update(model, hashes, nodes, k, i, decode_ch);
+    return decode_ch;
+}
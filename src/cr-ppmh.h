@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2011-2012 by Zhang Li <RichSelian at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE PROJECT AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE PROJECT OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef HEADER_CR_PPMH_H
+#define HEADER_CR_PPMH_H
+
+#include <stdint.h>
+#include "cr-rangecoder.h"
+#include "cr-datablock.h"
+
+/* ppm with hashed contexts of order 0 up to m_order (at most 6). a byte is coded in the
+ * longest known context, escaping down the chain to a uniform order -1 with every symbol
+ * of the escaped contexts excluded. contexts are variable sized symbol lists in one arena
+ * of the budget size, and the whole model restarts when the arena is full */
+#define PPMH_MAX_ORDER  6
+#define PPMH_MAX_BUDGET 2048
+
+typedef struct ppmh_model_t {
+    uint8_t*  m_arena;
+    uint32_t  m_arena_size;
+    uint32_t  m_arena_used;
+    uint32_t* m_table; /* hashed context -> arena offset of its node, 0 = none */
+    uint32_t  m_table_bits;
+    int       m_order;
+    int       m_budget; /* MB */
+    uint32_t  m_excluded[256]; /* symbol excluded while coding byte number m_stamp */
+    uint32_t  m_stamp;
+} ppmh_model_t;
+
+/* order and budget for new blocks, set by the -O and -M switches */
+extern int ppmh_order;
+extern int ppmh_budget;
+
+int  ppmh_model_setup(ppmh_model_t* model, int order, int budget); /* -1 on allocation failure */
+void ppmh_model_restart(ppmh_model_t* model);
+void ppmh_model_free(ppmh_model_t* model);
+
+void ppmh_encode(range_coder_t* coder, ppmh_model_t* model, uint64_t context, int encode_ch, data_block_t* o_block);
+int  ppmh_decode(range_coder_t* coder, ppmh_model_t* model, uint64_t context, uint8_t** input);
+
+#endif
@@ -37,44 +37,96 @@ void range_encoder_init(range_coder_t* coder) {
     coder->m_range = -1;
     coder->m_follow = 0;
     coder->m_cache = 0;
-    coder->m_carry = 0;
     return;
 }
 
-static inline void renormalize(range_coder_t* coder, data_block_t* o_block) {
-    if(coder->m_low < thresold || coder->m_carry) {
-        data_block_add(o_block, coder->m_cache + coder->m_carry);
-        while(coder->m_follow > 0) {
-            data_block_add(o_block, coder->m_carry - 1);
-            coder->m_follow -= 1;
+/* an encoded symbol shifts out at most 4 bytes (frq >= 1, sum < 2^24) */
+#define M_max_shift_bytes 4
+
+static inline uint8_t* renormalize(range_coder_t* coder, uint64_t low, uint8_t* output, data_block_t* o_block) {
+    uint32_t carry = low >> 32;
+
+    if(low - thresold >= top) { /* low < thresold || carry, in one compare */
+        *output++ = coder->m_cache + carry;
+        if(coder->m_follow > 0) { /* rare: a run of 0xff bytes waiting for a carry */
+            o_block->m_size = output - o_block->m_data;
+            data_block_reserve(o_block, o_block->m_size + coder->m_follow + M_max_shift_bytes);
+            output = o_block->m_data + o_block->m_size;
+            while(coder->m_follow > 0) {
+                *output++ = carry - 1;
+                coder->m_follow -= 1;
+            }
         }
-        coder->m_cache = coder->m_low >> 24;
-        coder->m_carry = 0;
+        coder->m_cache = (uint32_t)low >> 24;
     } else {
         coder->m_follow += 1;
     }
-    coder->m_low *= 256;
+    return output;
+}
+
+/* store a narrowed interval, shifting out the bytes it has settled */
+static inline void encode_interval(range_coder_t* coder, uint64_t low, uint32_t range, data_block_t* o_block) {
+    uint8_t* output;
+
+    if(range < top) {
+        if(o_block->m_capacity - o_block->m_size < M_max_shift_bytes) { /* reserve once per symbol, not per byte */
+            data_block_reserve(o_block, o_block->m_size + M_max_shift_bytes);
+        }
+        output = o_block->m_data + o_block->m_size;
+        do {
+            output = renormalize(coder, low, output, o_block);
+            low = (uint32_t)low << 8;
+            range *= 256;
+        } while(range < top);
+        o_block->m_size = output - o_block->m_data;
+    }
+    coder->m_low = low;
+    coder->m_range = range;
+    return;
+}
+
+/* range is coder->m_range scaled down by the symbol total */
+static inline void encode_scaled(range_coder_t* coder, uint32_t cum, uint32_t frq, uint32_t range, data_block_t* o_block) {
+    /* work on locals, byte stores through output may alias the coder */
+    encode_interval(coder, coder->m_low + (uint64_t)cum * range, range * frq, o_block);
     return;
 }
 
 void range_encoder_encode(range_coder_t* coder, uint32_t cum, uint32_t frq, uint32_t sum, data_block_t* o_block) {
-    coder->m_range /= sum;
-    coder->m_carry += (coder->m_low + cum * coder->m_range) < coder->m_low;
-    coder->m_low += cum * coder->m_range;
-    coder->m_range *= frq;
-    while(coder->m_range < top) {
-        coder->m_range *= 256;
-        renormalize(coder, o_block);
+    encode_scaled(coder, cum, frq, coder->m_range / sum, o_block);
+    return;
+}
+
+void range_encoder_encode_shift(range_coder_t* coder, uint32_t cum, uint32_t frq, uint32_t shift, data_block_t* o_block) {
+    encode_scaled(coder, cum, frq, coder->m_range >> shift, o_block);
+    return;
+}
+
+/* the 1 bit takes the rounding residue, so both halves stay nonempty for 0 < p0 < 1<<shift */
+void range_encoder_encode_bit(range_coder_t* coder, uint32_t p0, uint32_t shift, int bit, data_block_t* o_block) {
+    uint32_t bound = (coder->m_range >> shift) * p0;
+
+    if(!bit) {
+        encode_interval(coder, coder->m_low, bound, o_block);
+    } else {
+        encode_interval(coder, coder->m_low + bound, coder->m_range - bound, o_block);
     }
     return;
 }
 
 void range_encoder_flush(range_coder_t* coder, data_block_t* o_block) {
-    renormalize(coder, o_block);
-    renormalize(coder, o_block);
-    renormalize(coder, o_block);
-    renormalize(coder, o_block);
-    renormalize(coder, o_block);
+    uint64_t low = coder->m_low;
+    uint8_t* output;
+    int i;
+
+    data_block_reserve(o_block, o_block->m_size + 5);
+    output = o_block->m_data + o_block->m_size;
+    for(i = 0; i < 5; i++) {
+        output = renormalize(coder, low, output, o_block);
+        low = (uint32_t)low << 8;
+    }
+    o_block->m_size = output - o_block->m_data;
+    coder->m_low = low;
     return;
 }
 
@@ -99,6 +151,34 @@ void range_decoder_decode(range_coder_t* coder, uint32_t cum, uint32_t frq, uint
 }
 
 uint32_t range_decoder_decode_cum(range_coder_t* coder, uint32_t sum) {
+    uint32_t cum;
+
     coder->m_range /= sum;
-    return coder->m_cache / coder->m_range;
+    cum = coder->m_cache / coder->m_range;
+    return (cum < sum) ? cum : sum - 1; /* only corrupted input goes out of range */
+}
+
+uint32_t range_decoder_decode_cum_shift(range_coder_t* coder, uint32_t shift) {
+    uint32_t cum;
+
+    coder->m_range >>= shift;
+    cum = coder->m_cache / coder->m_range;
+    return (cum < (1u << shift)) ? cum : (1u << shift) - 1; /* only corrupted input goes out of range */
+}
+
+int range_decoder_decode_bit(range_coder_t* coder, uint32_t p0, uint32_t shift, uint8_t** input) {
+    uint32_t bound = (coder->m_range >> shift) * p0;
+    int bit = (coder->m_cache >= bound);
+
+    if(!bit) {
+        coder->m_range = bound;
+    } else {
+        coder->m_cache -= bound;
+        coder->m_range -= bound;
+    }
+    while(coder->m_range < top) {
+        coder->m_cache = (coder->m_cache * 256) + **input, *input += 1;
+        coder->m_range *= 256;
+    }
+    return bit;
 }
@@ -34,20 +34,24 @@
 
 struct data_block_t;
 
+/* encoder keeps a 64-bit low, bit 32 is the carry into pending bytes */
 typedef struct range_coder_struct {
-    uint32_t m_low;
+    uint64_t m_low;
     uint32_t m_range;
     uint32_t m_follow;
-    uint32_t m_carry;
     uint32_t m_cache;
 } range_coder_t;
 
 void range_encoder_init(range_coder_t* coder);
 void range_encoder_encode(range_coder_t* coder, uint32_t cum, uint32_t frq, uint32_t sum, struct data_block_t* o_block);
+void range_encoder_encode_shift(range_coder_t* coder, uint32_t cum, uint32_t frq, uint32_t shift, struct data_block_t* o_block);
+void range_encoder_encode_bit(range_coder_t* coder, uint32_t p0, uint32_t shift, int bit, struct data_block_t* o_block);
 void range_encoder_flush(range_coder_t* coder, struct data_block_t* o_block);
 
 void range_decoder_init(range_coder_t* coder, uint8_t** input);
 void range_decoder_decode(range_coder_t* coder, uint32_t cum, uint32_t frq, uint32_t sum, uint8_t** input);
 uint32_t range_decoder_decode_cum(range_coder_t* coder, uint32_t sum);
+uint32_t range_decoder_decode_cum_shift(range_coder_t* coder, uint32_t shift);
+int range_decoder_decode_bit(range_coder_t* coder, uint32_t p0, uint32_t shift, uint8_t** input);
 
 #endif
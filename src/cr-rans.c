@@ -0,0 +1,218 @@
+/*
+ * Copyright (C) 2011-2012 by Zhang Li <RichSelian at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE PROJECT AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE PROJECT OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <string.h>
+#include "cr-rans.h"
+#include "cr-datablock.h"
+
+static const uint32_t rans_l = 1 << 23; /* states stay in [rans_l, rans_l << 8) */
+
+/* scale counts to frequencies summing to RANS_PROB_SCALE, every counted symbol keeps at least 1 */
+static void rans_normalize(const uint32_t* counts, uint16_t* frq) {
+    uint64_t total = 0;
+    int32_t  left = RANS_PROB_SCALE;
+    int      top;
+    int      i;
+
+    for(i = 0; i < 256; i++) {
+        total += counts[i];
+    }
+    if(total == 0) { /* unused table */
+        memset(frq, 0, 256 * sizeof(uint16_t));
+        frq[0] = RANS_PROB_SCALE;
+        return;
+    }
+    for(i = 0; i < 256; i++) {
+        frq[i] = ((uint64_t)counts[i] * RANS_PROB_SCALE) / total;
+        frq[i] += (counts[i] > 0 && frq[i] == 0);
+        left -= frq[i];
+    }
+
+    while(left != 0) { /* settle the rounding error on the most frequent symbols */
+        for(top = 0, i = 1; i < 256; i++) {
+            top = (frq[i] > frq[top]) ? i : top;
+        }
+        if(left > 0) {
+            frq[top] += left;
+            left = 0;
+        } else {
+            i = (frq[top] - 1 < -left) ? frq[top] - 1 : -left;
+            frq[top] -= i;
+            left += i;
+        }
+    }
+    return;
+}
+
+/* frequencies as varints, a zero is followed by the number of zeros after it */
+static void rans_table_write(const uint16_t* frq, data_block_t* o_block) {
+    int i;
+    int run;
+
+    for(i = 0; i < 256; i++) {
+        if(frq[i] == 0) {
+            for(run = 0; i + 1 < 256 && frq[i + 1] == 0 && run < 255; run++) {
+                i++;
+            }
+            data_block_add(o_block, 0);
+            data_block_add(o_block, run);
+        } else if(frq[i] < 128) {
+            data_block_add(o_block, frq[i]);
+        } else {
+            data_block_add(o_block, 128 | (frq[i] >> 8));
+            data_block_add(o_block, frq[i] & 0xff);
+        }
+    }
+    return;
+}
+
+static int rans_table_read(rans_table_t* table, uint8_t** input, uint8_t* input_end) {
+    uint32_t cum = 0;
+    int i;
+    int run;
+
+    for(i = 0; i < 256; i++) {
+        if(*input + 2 > input_end) {
+            return -1;
+        }
+        if(**input == 0) {
+            run = (*input)[1];
+            *input += 2;
+            if(i + run >= 256) {
+                return -1;
+            }
+            memset(table->m_frq + i, 0, (run + 1) * sizeof(uint16_t));
+            memset(table->m_cum + i, 0, (run + 1) * sizeof(uint16_t));
+            i += run;
+            continue;
+        }
+        if(**input < 128) {
+            table->m_frq[i] = **input;
+            *input += 1;
+        } else {
+            table->m_frq[i] = ((**input & 0x7f) << 8) | (*input)[1];
+            *input += 2;
+        }
+        if(cum + table->m_frq[i] > RANS_PROB_SCALE) {
+            return -1;
+        }
+        table->m_cum[i] = cum;
+        memset(table->m_sym + cum, i, table->m_frq[i]);
+        cum += table->m_frq[i];
+    }
+    return (cum == RANS_PROB_SCALE) ? 0 : -1;
+}
+
+void rans_encode(data_block_t* pairs, int ntables, data_block_t* o_block) {
+    uint32_t counts[RANS_MAX_TABLES][256] = {{0}};
+    uint16_t frq[RANS_MAX_TABLES][256];
+    uint16_t cum[RANS_MAX_TABLES][256];
+    uint32_t state[2] = {rans_l, rans_l};
+    uint32_t x;
+    uint32_t x_max;
+    uint64_t i;
+    uint8_t* output;
+    uint8_t* output_end;
+    int t;
+    int s;
+
+    /* first pass -- build and write the tables */
+    for(i = 0; i < pairs->m_size; i += 2) {
+        counts[pairs->m_data[i]][pairs->m_data[i + 1]]++;
+    }
+    for(t = 0; t < ntables; t++) {
+        rans_normalize(counts[t], frq[t]);
+        for(cum[t][0] = 0, s = 1; s < 256; s++) {
+            cum[t][s] = cum[t][s - 1] + frq[t][s - 1];
+        }
+        rans_table_write(frq[t], o_block);
+    }
+
+    /* second pass -- code backwards, a symbol emits at most 2 bytes */
+    data_block_reserve(o_block, o_block->m_size + pairs->m_size + 8);
+    output_end = o_block->m_data + o_block->m_size + pairs->m_size + 8;
+    output = output_end;
+
+    for(i = pairs->m_size / 2; i > 0; i--) {
+        t = pairs->m_data[i * 2 - 2];
+        s = pairs->m_data[i * 2 - 1];
+        x = state[(i - 1) % 2];
+        x_max = ((rans_l >> RANS_PROB_BITS) << 8) * frq[t][s];
+        while(x >= x_max) {
+            *--output = x;
+            x >>= 8;
+        }
+        state[(i - 1) % 2] = ((x / frq[t][s]) << RANS_PROB_BITS) + (x % frq[t][s]) + cum[t][s];
+    }
+    for(s = 1; s >= 0; s--) { /* state 0 is read first */
+        *--output = state[s] >> 24;
+        *--output = state[s] >> 16;
+        *--output = state[s] >> 8;
+        *--output = state[s];
+    }
+    memmove(o_block->m_data + o_block->m_size, output, output_end - output);
+    o_block->m_size += output_end - output;
+    return;
+}
+
+int rans_decoder_init(rans_decoder_t* decoder, rans_table_t* tables, int ntables, uint8_t** input, uint8_t* input_end) {
+    int t;
+    int i;
+
+    for(t = 0; t < ntables; t++) {
+        if(rans_table_read(&tables[t], input, input_end) != 0) {
+            return -1;
+        }
+    }
+    if(*input + 8 > input_end) {
+        return -1;
+    }
+    for(i = 0; i < 2; i++) {
+        decoder->m_state[i] = (*input)[0] | (*input)[1] << 8 | (*input)[2] << 16 | (uint32_t)(*input)[3] << 24;
+        *input += 4;
+    }
+    decoder->m_next = 0;
+    return 0;
+}
+
+uint32_t rans_decode(rans_decoder_t* decoder, rans_table_t* table, uint8_t** input) {
+    uint32_t x = decoder->m_state[decoder->m_next];
+    uint32_t slot = x & (RANS_PROB_SCALE - 1);
+    uint32_t s = table->m_sym[slot];
+
+    x = table->m_frq[s] * (x >> RANS_PROB_BITS) + slot - table->m_cum[s];
+    if(x < rans_l) { /* two bytes always renormalize a valid state, corrupted ones stay bounded */
+        x = (x << 8) | *(*input)++;
+        if(x < rans_l) {
+            x = (x << 8) | *(*input)++;
+        }
+    }
+    decoder->m_state[decoder->m_next] = x;
+    decoder->m_next ^= 1;
+    return s;
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2011-2012 by Zhang Li <RichSelian at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE PROJECT AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE PROJECT OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef HEADER_CR_RANS_H
+#define HEADER_CR_RANS_H
+
+#include <stdlib.h>
+#include <stdint.h>
+
+struct data_block_t;
+
+/* static rANS backend for side streams -- two-pass: a recorded stream of
+ * (table, symbol) byte pairs is counted into per-block frequency tables,
+ * then coded in reverse over two interleaved states. decoding is a table
+ * lookup per symbol */
+#define RANS_PROB_BITS  12
+#define RANS_PROB_SCALE (1 << RANS_PROB_BITS)
+#define RANS_MAX_TABLES 8
+
+typedef struct rans_table_t {
+    uint16_t m_frq[256];
+    uint16_t m_cum[256];
+    uint8_t  m_sym[RANS_PROB_SCALE]; /* slot to symbol */
+} rans_table_t;
+
+typedef struct rans_decoder_t {
+    uint32_t m_state[2];
+    uint32_t m_next;
+} rans_decoder_t;
+
+void rans_encode(struct data_block_t* pairs, int ntables, struct data_block_t* o_block);
+
+int  rans_decoder_init(rans_decoder_t* decoder, rans_table_t* tables, int ntables, uint8_t** input, uint8_t* input_end);
+uint32_t rans_decode(rans_decoder_t* decoder, rans_table_t* table, uint8_t** input);
+
+#endif
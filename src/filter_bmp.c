@@ -146,21 +146,14 @@ static uint32_t bmp_transform_column_rgb_delta(uint8_t* buf, uint32_t len, int w
     return row_size * trans_column;
 }
 
-uint32_t bmp_transform(uint8_t* buf, uint32_t len, int en_de) {
-    static int flag = 0;
-    static int curr = 0;
-    static int size = 0;
-    static int row_size = 0;
-    static int bpp = 0;
-    static int width = 0;
-    static int height = 0;
-    static int skip_size = 0;
+uint32_t bmp_transform(void* state, uint8_t* buf, uint32_t len, int en_de) {
+    bmp_transform_state_t* st = state;
 
     bmp_header_t* header = (bmp_header_t*)buf;
     int trans_size;
     uint8_t* start = buf;
 
-    if(!flag) {
+    if(!st->m_flag) {
         if(len < sizeof(*header) /* check bitmap header */
                 || header->m_magic != BMP_MAGIC
                 || header->m_planes != 1
@@ -169,36 +162,36 @@ uint32_t bmp_transform(uint8_t* buf, uint32_t len, int en_de) {
                 || (header->m_bits_per_pixel != 24 && header->m_bits_per_pixel != 32)) {
             return 0;
         }
-        width = abs(header->m_width);
-        height = abs(header->m_height);
-        row_size = (header->m_bits_per_pixel * width + 31) / 32 * 4;
-        bpp = header->m_bits_per_pixel;
+        st->m_width = abs(header->m_width);
+        st->m_height = abs(header->m_height);
+        st->m_row_size = (header->m_bits_per_pixel * st->m_width + 31) / 32 * 4;
+        st->m_bpp = header->m_bits_per_pixel;
 
-        if(width < 4 || height < 4 || width >= (1 << 20) || height >= (1 << 20)) {
+        if(st->m_width < 4 || st->m_height < 4 || st->m_width >= (1 << 20) || st->m_height >= (1 << 20)) {
             return 0;
         }
 
         start = buf + header->m_image_offset;
-        curr = header->m_image_offset;
-        size = height * row_size;
-        skip_size = 0;
-        flag = 1;
+        st->m_curr = header->m_image_offset;
+        st->m_size = st->m_height * st->m_row_size;
+        st->m_skip_size = 0;
+        st->m_flag = 1;
         return header->m_image_offset;
     }
 
-    while(skip_size > 0) { /* skip broken rows */
-        trans_size = min(skip_size, len);
-        curr += trans_size;
-        skip_size -= trans_size;
+    while(st->m_skip_size > 0) { /* skip broken rows */
+        trans_size = min(st->m_skip_size, len);
+        st->m_curr += trans_size;
+        st->m_skip_size -= trans_size;
         return trans_size;
     }
-    trans_size = bmp_transform_column_rgb_delta(start, min(len, size - curr), width, row_size, bpp, en_de);
-    curr += trans_size;
+    trans_size = bmp_transform_column_rgb_delta(start, min(len, st->m_size - st->m_curr), st->m_width, st->m_row_size, st->m_bpp, en_de);
+    st->m_curr += trans_size;
 
-    if(curr < size) { /* transform not done -- the last row is broken */
-        skip_size = min(row_size, size - curr);
+    if(st->m_curr < st->m_size) { /* transform not done -- the last row is broken */
+        st->m_skip_size = min(st->m_row_size, st->m_size - st->m_curr);
     } else {
-        flag = 0;
+        st->m_flag = 0;
     }
     return trans_size;
 }
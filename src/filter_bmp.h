@@ -32,6 +32,18 @@
 #include <stdlib.h>
 #include <stdint.h>
 
-uint32_t bmp_transform(uint8_t* buf, uint32_t len, int en_de);
+/* transform state -- a bitmap may be transformed in several calls */
+typedef struct bmp_transform_state_t {
+    int m_flag;
+    int m_curr;
+    int m_size;
+    int m_row_size;
+    int m_bpp;
+    int m_width;
+    int m_height;
+    int m_skip_size;
+} bmp_transform_state_t;
+
+uint32_t bmp_transform(void* state, uint8_t* buf, uint32_t len, int en_de);
 
 #endif
@@ -128,29 +128,27 @@ elf32_analysis_t elf32_i386_analyze(uint8_t *off, uint32_t limit) {
     return analysis;
 }
 
-uint32_t elf_i386_transform(uint8_t *buf, uint32_t len, int en_de) {
-    static int      flag  = 0;
-    static uint32_t curr  = 0;
-    static uint32_t imsz  = 0;
+uint32_t elf_i386_transform(void* state, uint8_t *buf, uint32_t len, int en_de) {
+    i386_transform_state_t* st = state;
 
-    uint32_t size = min(imsz - curr, len);
+    uint32_t size = min(st->m_imsz - st->m_curr, len);
     uint32_t ret = size;
     uint8_t* start = buf;
 
-    if (!flag) {
+    if (!st->m_flag) {
         elf32_analysis_t analysis = elf32_i386_analyze(buf, len);
         if (!analysis.ana_legal) {
             return 0;
         }
-        imsz = analysis.ana_ps_size_est - analysis.ana_ps_begin;
+        st->m_imsz = analysis.ana_ps_size_est - analysis.ana_ps_begin;
         start = buf + analysis.ana_ps_begin;
-        size = min(imsz, len);
+        size = min(st->m_imsz, len - analysis.ana_ps_begin);
         ret = size;
     }
 
-    i386_e8e9(start, size, en_de, curr, imsz);
-    curr += size;
-    flag = (curr < imsz);
+    i386_e8e9(start, size, en_de, st->m_curr, st->m_imsz);
+    st->m_curr += size;
+    st->m_flag = (st->m_curr < st->m_imsz);
 
     return ret;
 }
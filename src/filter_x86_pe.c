@@ -79,7 +79,7 @@ static analysis_result pe_i386_analyze(uint8_t* buf, uint32_t hdr_off, uint32_t
     analysis_result result = { 0, 0, 0 };
     CoffFileHeader* header = (CoffFileHeader*) (buf + hdr_off);
 
-    if(hdr_off + len < sizeof(CoffFileHeader))
+    if(len - hdr_off < sizeof(CoffFileHeader))
         return result;
 
     if(header->Machine != IMAGE_FILE_MACHINE_I386 && header->Characteristics & IMAGE_FILE_EXECUTABLE_IMAGE)
@@ -91,7 +91,7 @@ static analysis_result pe_i386_analyze(uint8_t* buf, uint32_t hdr_off, uint32_t
     result.size_hdr = sec_tbl_off + sec_num * sizeof(SectionHeader);
     result.size_est = result.size_hdr;
 
-    if(hdr_off + len < result.size_hdr)
+    if(len - hdr_off < result.size_hdr)
         return result;
 
     SectionHeader* sec_table = (SectionHeader*)(buf + hdr_off + sec_tbl_off);
@@ -116,7 +116,7 @@ static inline uint32_t pe_check_magic(uint8_t* buf, uint32_t len) {
 
     hdr_off = *(uint32_t*)(buf + DOS_LFA_NEW_OFFSET);
 
-    if(hdr_off >= len)
+    if(hdr_off >= len - 4)
         return 0;
 
     if(*(uint32_t*)(buf + hdr_off) != IMAGE_NT_SIGNATURE)
@@ -125,17 +125,15 @@ static inline uint32_t pe_check_magic(uint8_t* buf, uint32_t len) {
     return hdr_off;
 }
 
-uint32_t pe_i386_transform(uint8_t* buf, uint32_t len, int en_de) {
-    static int      flag = 0;
-    static uint32_t curr = 0;
-    static uint32_t imsz = 0;   // [hdr_end, est_end]
+uint32_t pe_i386_transform(void* state, uint8_t* buf, uint32_t len, int en_de) {
+    i386_transform_state_t* st = state;
 
     uint8_t*    start   = buf;
-    uint32_t    size    = min(imsz - curr, len);
+    uint32_t    size    = min(st->m_imsz - st->m_curr, len);
     uint32_t    ret     = size;
 
-    if(!flag) {
-        curr = 0;
+    if(!st->m_flag) {
+        st->m_curr = 0;
 
         uint32_t hdr_off = pe_check_magic(buf, len);
         if (!hdr_off)
@@ -146,14 +144,14 @@ uint32_t pe_i386_transform(uint8_t* buf, uint32_t len, int en_de) {
             return 0;
 
         start   = buf + analysis.size_hdr;
-        imsz    = analysis.size_est - analysis.size_hdr;
-        size    = min(imsz, len - analysis.size_hdr);
+        st->m_imsz = analysis.size_est - analysis.size_hdr;
+        size    = min(st->m_imsz, len - analysis.size_hdr);
         ret     = size + analysis.size_hdr;
     }
 
-    i386_e8e9(start, size, en_de, curr, imsz);
-    curr += size;
-    flag = curr < imsz;
+    i386_e8e9(start, size, en_de, st->m_curr, st->m_imsz);
+    st->m_curr += size;
+    st->m_flag = st->m_curr < st->m_imsz;
 
     return ret;
 }
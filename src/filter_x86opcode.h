@@ -32,13 +32,20 @@
 
 #include <stdint.h>
 
-uint32_t elf_i386_transform(uint8_t *buf, uint32_t len, int en_de);
-uint32_t  pe_i386_transform(uint8_t *buf, uint32_t len, int en_de);
+/* transform state -- an executable image may be transformed in several calls */
+typedef struct i386_transform_state_t {
+    int      m_flag;
+    uint32_t m_curr;
+    uint32_t m_imsz;
+} i386_transform_state_t;
+
+uint32_t elf_i386_transform(void* state, uint8_t *buf, uint32_t len, int en_de);
+uint32_t  pe_i386_transform(void* state, uint8_t *buf, uint32_t len, int en_de);
 
 static inline void i386_e8e9(uint8_t *buf, uint32_t limit, int en_de, int32_t ncur, int32_t nend) {
     int32_t i = 0;
 
-    while (i < limit - 8) {
+    while (i + 8 < limit) {
         if ((buf[i++] & 254) == 0xe8) {
             int32_t *operand = (int32_t*)(buf + i);
 
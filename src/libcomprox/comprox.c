@@ -0,0 +1,255 @@
+/*
+ * Copyright (C) 2011-2012 by Zhang Li <RichSelian at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE PROJECT AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE PROJECT OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <string.h>
+#include "comprox.h"
+#include "../cr-datablock.h"
+#include "../cr-dicpick.h"
+#include "../cr-diccode.h"
+#include "../cr-engine.h"
+#include "../cr-block.h"
+
+static const lz_engine_t* const engines[] = {
+    &lz_engine_rox,
+    &lz_engine_rolz,
+    &lz_engine_rop,
+};
+static const int nengines = sizeof(engines) / sizeof(engines[0]);
+
+static const comprox_params_t default_params = {
+    COMPROX_ENGINE_LZ77,
+    16 * 1048576, /* default block size = 16MB */
+    1,
+    0,
+};
+
+static inline void append_data(data_block_t* ob, const void* data, uint64_t size) {
+    uint64_t pos = ob->m_size;
+
+    data_block_resize(ob, pos + size);
+    memcpy(ob->m_data + pos, data, size);
+    return;
+}
+
+int comprox_compress(const comprox_params_t* params, const void* src, size_t src_size, void** dst, size_t* dst_size) {
+    const uint8_t* src_data = src;
+    const lz_engine_t* engine;
+    block_worker_t* workers;
+    dictionary_t* dic;
+    data_block_t ob = INITIAL_BLOCK;
+    data_block_t dic_xb = INITIAL_BLOCK;
+    data_block_t dic_yb = INITIAL_BLOCK;
+    data_block_t index = INITIAL_BLOCK;
+    block_header_t end_header = {0};
+    uint64_t block_size;
+    uint64_t nblock = 0;
+    uint64_t pos = 0;
+    uint64_t size;
+    uint32_t dic_yb_size;
+    int num_threads;
+    int nworkers;
+    int i;
+
+    if(params == NULL) {
+        params = &default_params;
+    }
+    if(params->m_engine < 0 || params->m_engine >= nengines) {
+        return -1;
+    }
+    engine = engines[params->m_engine];
+    block_size = (params->m_block_size > 0) ? params->m_block_size : default_params.m_block_size;
+    num_threads = (params->m_num_threads > 0) ? params->m_num_threads : default_params.m_num_threads;
+    if(block_size > BLOCK_SIZE_MAX) {
+        return -1;
+    }
+
+    dic = malloc(sizeof(dictionary_t));
+    dictionary_init(dic);
+    workers = block_workers_create(engine, dic, num_threads);
+    for(i = 0; i < num_threads; i++) {
+        workers[i].m_filt_enable = params->m_filt_enable;
+        workers[i].m_print_information = 0;
+    }
+    append_data(&ob, engine->m_magic_header, strlen(engine->m_magic_header));
+
+    /* build and encode static dictionary */
+    dicpick_buffer(src_data, src_size, &dic_xb);
+    block_dictionary_encode(&workers[0], &dic_xb, &dic_yb);
+    dic_yb_size = dic_yb.m_size;
+    append_data(&ob, &dic_yb_size, sizeof(dic_yb_size));
+    append_data(&ob, dic_yb.m_data, dic_yb.m_size);
+    data_block_destroy(&dic_xb);
+    data_block_destroy(&dic_yb);
+
+    while(pos < src_size) {
+        /* split blocks -- in parallel mode every block is coded with reset models */
+        for(nworkers = 0; nworkers < num_threads && pos < src_size; nworkers++) {
+            size = (src_size - pos < block_size) ? src_size - pos : block_size;
+            data_block_resize(&workers[nworkers].m_ib, size);
+            memcpy(workers[nworkers].m_ib.m_data, src_data + pos, size);
+            workers[nworkers].m_header.m_reset = (num_threads > 1 || nblock == 0);
+            workers[nworkers].m_raw_offset = pos;
+            pos += size;
+            nblock += 1;
+        }
+        run_workers(workers, nworkers, encode_block_thread);
+
+        for(i = 0; i < nworkers; i++) {
+            block_index_add(&index, workers[i].m_raw_offset, ob.m_size);
+            append_data(&ob, &workers[i].m_header, sizeof(block_header_t));
+            append_data(&ob, workers[i].m_ob.m_data, workers[i].m_ob.m_size);
+        }
+    }
+    block_workers_destroy(workers, num_threads);
+    dictionary_free(dic);
+    free(dic);
+
+    /* end-of-blocks marker and block index */
+    append_data(&ob, &end_header, sizeof(end_header));
+    block_index_seal(&index, src_size, ob.m_size);
+    append_data(&ob, index.m_data, index.m_size);
+    data_block_destroy(&index);
+
+    *dst = ob.m_data;
+    *dst_size = ob.m_size;
+    return 0;
+}
+
+int comprox_decompress(const comprox_params_t* params, const void* src, size_t src_size, void** dst, size_t* dst_size) {
+    const uint8_t* src_data = src;
+    const lz_engine_t* engine = NULL;
+    block_worker_t* workers;
+    dictionary_t* dic;
+    data_block_t ob = INITIAL_BLOCK;
+    data_block_t dic_xb = INITIAL_BLOCK;
+    data_block_t dic_yb = INITIAL_BLOCK;
+    uint32_t dic_size;
+    uint64_t pos = 0;
+    int num_threads;
+    int nworkers;
+    int npending = 0;
+    int corrupted = 0;
+    int end = 0;
+    int i;
+
+    if(params == NULL) {
+        params = &default_params;
+    }
+    num_threads = (params->m_num_threads > 0) ? params->m_num_threads : default_params.m_num_threads;
+
+    /* select engine by magic header */
+    for(i = 0; i < nengines; i++) {
+        pos = strlen(engines[i]->m_magic_header);
+        if(src_size >= pos && memcmp(src_data, engines[i]->m_magic_header, pos) == 0) {
+            engine = engines[i];
+            break;
+        }
+    }
+    if(engine == NULL || src_size - pos < sizeof(dic_size)) {
+        return -1;
+    }
+    memcpy(&dic_size, src_data + pos, sizeof(dic_size));
+    pos += sizeof(dic_size);
+    if(dic_size > src_size - pos) {
+        return -1;
+    }
+
+    dic = malloc(sizeof(dictionary_t));
+    dictionary_init(dic);
+    workers = block_workers_create(engine, dic, num_threads);
+    for(i = 0; i < num_threads; i++) {
+        workers[i].m_print_information = 0;
+    }
+
+    /* decode static dictionary */
+    data_block_resize(&dic_yb, dic_size);
+    memcpy(dic_yb.m_data, src_data + pos, dic_size);
+    pos += dic_size;
+    corrupted = (block_dictionary_decode(&workers[0], &dic_yb, &dic_xb) != 0);
+    data_block_destroy(&dic_xb);
+    data_block_destroy(&dic_yb);
+
+    while(!corrupted) {
+        /* split blocks -- a block without reset models continues the context of its
+         * previous block, so it is left pending to the next round
+         */
+        for(nworkers = npending, npending = 0; nworkers < num_threads && !end; nworkers++) {
+            if(src_size - pos < sizeof(block_header_t)) {
+                corrupted = 1;
+                break;
+            }
+            memcpy(&workers[nworkers].m_header, src_data + pos, sizeof(block_header_t));
+            pos += sizeof(block_header_t);
+            if(workers[nworkers].m_header.m_size == 0) { /* end of blocks, block index is not needed here */
+                end = 1;
+                break;
+            }
+            if(workers[nworkers].m_header.m_size > src_size - pos) {
+                corrupted = 1;
+                break;
+            }
+            data_block_resize(&workers[nworkers].m_ib, workers[nworkers].m_header.m_size);
+            memcpy(workers[nworkers].m_ib.m_data, src_data + pos, workers[nworkers].m_header.m_size);
+            pos += workers[nworkers].m_header.m_size;
+
+            if(nworkers > 0 && !workers[nworkers].m_header.m_reset) {
+                npending = 1;
+                break;
+            }
+        }
+        if(corrupted || nworkers == 0) {
+            break;
+        }
+        run_workers(workers, nworkers, decode_block_thread);
+
+        for(i = 0; i < nworkers; i++) {
+            if(workers[i].m_corrupted) { /* corrupted input or checksum mismatch */
+                corrupted = 1;
+                break;
+            }
+            append_data(&ob, workers[i].m_ob.m_data, workers[i].m_ob.m_size);
+        }
+        block_workers_carry(workers, nworkers, npending);
+    }
+    block_workers_destroy(workers, num_threads);
+    dictionary_free(dic);
+    free(dic);
+
+    if(corrupted) {
+        data_block_destroy(&ob);
+        return -1;
+    }
+    *dst = ob.m_data;
+    *dst_size = ob.m_size;
+    return 0;
+}
+
+void comprox_free(void* buf) {
+    free(buf);
+    return;
+}
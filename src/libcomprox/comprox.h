@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2011-2012 by Zhang Li <RichSelian at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE PROJECT AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE PROJECT OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef HEADER_COMPROX_H
+#define HEADER_COMPROX_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__GNUC__)
+#define COMPROX_API __attribute__((visibility("default")))
+#else
+#define COMPROX_API
+#endif
+
+/* engines */
+#define COMPROX_ENGINE_LZ77 0   /* comprox */
+#define COMPROX_ENGINE_ROLZ 1   /* comprolz */
+#define COMPROX_ENGINE_LZP  2   /* comprop */
+
+typedef struct comprox_params_t {
+    int      m_engine;          /* one of COMPROX_ENGINE_*, compression only */
+    uint64_t m_block_size;      /* block size in bytes, 0 = default (16MB), up to 4095MB */
+    int      m_num_threads;     /* number of blocks coded in parallel, 0 = default (1) */
+    int      m_filt_enable;     /* use PE/ELF/BMP filter */
+} comprox_params_t;
+
+/* buffer-to-buffer compression, output is the same format as the command line tools
+ * write, and is allocated by the library (release it with comprox_free()).
+ * params can be NULL for defaults. return 0 on success, -1 on error.
+ */
+COMPROX_API int comprox_compress(const comprox_params_t* params, const void* src, size_t src_size, void** dst, size_t* dst_size);
+
+/* the engine is selected by the magic header of src */
+COMPROX_API int comprox_decompress(const comprox_params_t* params, const void* src, size_t src_size, void** dst, size_t* dst_size);
+
+COMPROX_API void comprox_free(void* buf);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
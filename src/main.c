@@ -29,14 +29,20 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <sys/time.h>
 #include "cr-datablock.h"
-#include "cr-filter.h"
 #include "cr-dicpick.h"
 #include "cr-diccode.h"
+#include "cr-engine.h"
+#include "cr-block.h"
+#include "cr-crc32c.h"
+#include "miniport-mmap.h"
 
 #if defined(_WIN32) || defined(_WIN64) /* windows ports */
 #include <fcntl.h> /* for setmode() */
+#define fseeko _fseeki64 /* 64-bit offsets */
+#define ftello _ftelli64
 #endif
 
 /* implement in
@@ -44,72 +50,528 @@
  *  src/rolzmain/main.c
  *  src/ropmain/main.c
  */
-extern const char* cr_magic_header;
 extern const char* cr_start_info;
 extern const char* cr_usage_info;
 extern int cr_process_arguments(int argc, char** argv);
 
-/* implement in
- *  src/roxmain/cr-coder.c
- *  src/rolzmain/cr-coder.c
- *  src/ropmain/cr-coder.c
- */
-void reset_models();
-void lzencode(struct data_block_t* ib, struct data_block_t* ob, int print_information);
-void lzdecode(struct data_block_t* ib, struct data_block_t* ob, int print_information);
-
 /* main wrapper configuration */
 uint32_t cr_split_size = 16 * 1048576; /* default block size = 16MB */
 int cr_filt_enable = 0;
 int cr_prec_enable = 0;
+int cr_num_threads = 1; /* number of blocks coded in parallel */
+int cr_independent = 0; /* reset models for every block with -T1 too, -I */
+const char* cr_model_name = NULL; /* trained models to start from, -W */
 
 /* handle magic header */
-static inline int write_magic(FILE* stream) {
-    fwrite(cr_magic_header, 1, strlen(cr_magic_header), stream);
+static inline int write_magic(FILE* stream, const char* magic_header) {
+    fwrite(magic_header, 1, strlen(magic_header), stream);
     return 0;
 }
-static inline int check_magic(FILE* stream) {
+static inline int check_magic(FILE* stream, const char* magic_header) {
     char in_magic_header[256] = {0};
 
-    fread(in_magic_header, 1, strlen(cr_magic_header), stream);
-    if(memcmp(in_magic_header, cr_magic_header, strlen(cr_magic_header)) == 0) {
+    fread(in_magic_header, 1, strlen(magic_header), stream);
+    if(memcmp(in_magic_header, magic_header, strlen(magic_header)) == 0) {
         return 1;
     }
     return 0;
 }
 
-/* swap block */
-static inline void swap_xyblock(data_block_t** xb, data_block_t** yb) {
-    data_block_t* tmpblock = *xb;
-    *xb = *yb;
-    *yb = tmpblock;
+/* read input block -- data buffered in prefix (used for building the static
+ * dictionary of a non-seekable input) is consumed before reading from stream
+ */
+static inline uint32_t read_block(FILE* stream, data_block_t* prefix, uint32_t* prefix_pos, data_block_t* ob, uint32_t size) {
+    uint32_t nread = 0;
+
+    data_block_resize(ob, size);
+    if(*prefix_pos < prefix->m_size) {
+        nread = (prefix->m_size - *prefix_pos < size) ? prefix->m_size - *prefix_pos : size;
+        memcpy(ob->m_data, prefix->m_data + *prefix_pos, nread);
+        *prefix_pos += nread;
+        if(*prefix_pos == prefix->m_size) { /* prefix consumed, release it */
+            data_block_destroy(prefix);
+            *prefix = INITIAL_BLOCK;
+            *prefix_pos = 0;
+        }
+    }
+    if(nread < size) {
+        nread += fread(ob->m_data + nread, 1, size - nread, stream);
+    }
+    ob->m_size = nread;
+    return nread;
+}
+
+/* read and decode static dictionary, return its size in stream, or -1 on error */
+static inline int read_dictionary(FILE* stream, block_worker_t* worker) {
+    data_block_t dic_xb = INITIAL_BLOCK;
+    data_block_t dic_yb = INITIAL_BLOCK;
+    uint32_t size;
+
+    if(fread(&size, sizeof(size), 1, stream) != 1) {
+        return -1;
+    }
+    data_block_resize(&dic_yb, size);
+    if(fread(dic_yb.m_data, 1, size, stream) != size) {
+        data_block_destroy(&dic_yb);
+        return -1;
+    }
+    if(block_dictionary_decode(worker, &dic_yb, &dic_xb) != 0) {
+        data_block_destroy(&dic_xb);
+        data_block_destroy(&dic_yb);
+        return -1;
+    }
+    data_block_destroy(&dic_xb);
+    data_block_destroy(&dic_yb);
+    return sizeof(size) + size;
+}
+
+/* trained models -- engine magic header, MODEL_MAGIC, snapshot size, snapshot and its crc32c.
+ * a snapshot is only read by the engine and build which wrote it
+ */
+#define MODEL_MAGIC "CRWM"
+
+static inline uint64_t write_models(FILE* stream, const lz_engine_t* engine, lz_context_t* ctx) { /* return bytes written */
+    data_block_t snapshot = INITIAL_BLOCK;
+    uint64_t size;
+    uint32_t crc;
+
+    engine->m_context_save(ctx, &snapshot);
+    size = snapshot.m_size;
+    crc = crc32c(0, snapshot.m_data, snapshot.m_size);
+    write_magic(stream, engine->m_magic_header);
+    fwrite(MODEL_MAGIC, 1, strlen(MODEL_MAGIC), stream);
+    fwrite(&size, sizeof(size), 1, stream);
+    fwrite(snapshot.m_data, 1, snapshot.m_size, stream);
+    fwrite(&crc, sizeof(crc), 1, stream);
+    data_block_destroy(&snapshot);
+    return strlen(engine->m_magic_header) + strlen(MODEL_MAGIC) + sizeof(size) + size + sizeof(crc);
+}
+
+/* read trained models into snapshot and check them by loading into ctx, which is reset after */
+static inline int read_models(const char* name, const lz_engine_t* engine, lz_context_t* ctx, data_block_t* snapshot) {
+    FILE* stream = fopen(name, "rb");
+    uint64_t size;
+    uint32_t crc;
+    int ret = -1;
+
+    if(stream == NULL) {
+        perror("fopen()");
+        return -1;
+    }
+    if(check_magic(stream, engine->m_magic_header)
+            && check_magic(stream, MODEL_MAGIC)
+            && fread(&size, sizeof(size), 1, stream) == 1
+            && size <= BLOCK_SIZE_MAX) {
+        data_block_resize(snapshot, size);
+        if(fread(snapshot->m_data, 1, size, stream) == size
+                && fread(&crc, sizeof(crc), 1, stream) == 1
+                && crc == crc32c(0, snapshot->m_data, size)
+                && engine->m_context_load(ctx, snapshot) == 0) {
+            ret = 0;
+        }
+        engine->m_context_reset(ctx);
+    }
+    fclose(stream);
+    return ret;
+}
+
+/* read block index from the end of stream, entries are allocated by malloc().
+ * the index is checked before use -- it must sit between the stream header and the trailer,
+ * and blocks must start at raw offset 0 with strictly increasing raw and compressed offsets
+ */
+static inline int read_block_index(FILE* stream, uint64_t header_size, block_index_trailer_t* trailer, block_index_entry_t** entries) {
+    uint64_t end;
+    uint32_t i;
+
+    *entries = NULL;
+    if(fseeko(stream, -(int64_t)sizeof(*trailer), SEEK_END) != 0
+            || (int64_t)(end = ftello(stream)) < 0
+            || fread(trailer, sizeof(*trailer), 1, stream) != 1
+            || memcmp(trailer->m_magic, BLOCK_INDEX_MAGIC, sizeof(trailer->m_magic)) != 0) {
+        return -1;
+    }
+    if(trailer->m_index_offset < header_size + sizeof(block_header_t) /* at least the end-of-blocks marker */
+            || trailer->m_index_offset > end
+            || end - trailer->m_index_offset != (uint64_t)trailer->m_nblock * sizeof(block_index_entry_t)
+            || (trailer->m_nblock == 0) != (trailer->m_raw_size == 0)) { /* only empty data has no blocks */
+        return -1;
+    }
+    if(trailer->m_nblock == 0) {
+        return 0;
+    }
+
+    if(fseeko(stream, trailer->m_index_offset, SEEK_SET) != 0
+            || (*entries = malloc(trailer->m_nblock * sizeof(block_index_entry_t))) == NULL
+            || fread(*entries, sizeof(block_index_entry_t), trailer->m_nblock, stream) != trailer->m_nblock) {
+        goto Corrupted;
+    }
+    for(i = 0; i < trailer->m_nblock; i++) {
+        if((i == 0 && ((*entries)[i].m_raw_offset != 0 || (*entries)[i].m_offset < header_size))
+                || (i > 0 && (*entries)[i].m_raw_offset <= (*entries)[i - 1].m_raw_offset)
+                || (i > 0 && (*entries)[i].m_offset <= (*entries)[i - 1].m_offset)
+                || (*entries)[i].m_raw_offset >= trailer->m_raw_size
+                || (*entries)[i].m_offset + sizeof(block_header_t) > trailer->m_index_offset - sizeof(block_header_t)) {
+            goto Corrupted;
+        }
+    }
+    return 0;
+
+Corrupted:
+    free(*entries);
+    *entries = NULL;
+    return -1;
+}
+
+/* block reader/writer -- run in their own threads, so reading the next blocks and
+ * writing the previous blocks are overlapped with coding the current blocks
+ */
+typedef struct block_reader_t {
+    FILE*           m_stream;
+    data_block_t*   m_blocks;       /* one more slot for a pending block */
+    block_header_t* m_headers;
+    int             m_nblock;       /* number of blocks read in this round */
+    int             m_capacity;
+    int             m_pending;      /* m_blocks[m_nblock] is read but belongs to the next round */
+    uint64_t        m_remain;       /* number of blocks remain to read */
+    uint64_t        m_size;         /* number of bytes read */
+    data_block_t*   m_prefix;
+    uint32_t*       m_prefix_pos;
+    uint8_t*        m_map;          /* blocks are borrowed from a mapped file if not NULL */
+    uint64_t        m_map_size;
+    uint64_t        m_map_pos;
+    uint64_t        m_map_round;    /* start of the previous round */
+    uint64_t        m_map_released; /* pages before it are released */
+    uint64_t        m_map_pending;  /* start of the pending block */
+    pthread_t       m_thread;
+} block_reader_t;
+
+typedef struct block_writer_t {
+    FILE*           m_stream;
+    data_block_t*   m_blocks;
+    block_header_t* m_headers;
+    uint64_t*       m_begin;        /* range of each block to write */
+    uint64_t*       m_end;
+    int             m_nblock;
+    int             m_write_headers;
+    int             m_running;
+    pthread_t       m_thread;
+} block_writer_t;
+
+static void block_reader_init(block_reader_t* reader, FILE* stream, int capacity) {
+    memset(reader, 0, sizeof(block_reader_t));
+    reader->m_stream = stream;
+    reader->m_blocks = calloc(capacity + 1, sizeof(data_block_t));
+    reader->m_headers = calloc(capacity + 1, sizeof(block_header_t));
+    reader->m_capacity = capacity;
+    reader->m_remain = UINT64_MAX;
+    return;
+}
+
+static void block_reader_free(block_reader_t* reader) {
+    int i;
+
+    for(i = 0; i < reader->m_capacity + 1; i++) {
+        data_block_destroy(&reader->m_blocks[i]);
+    }
+    free(reader->m_blocks);
+    free(reader->m_headers);
+    return;
+}
+
+static void block_writer_init(block_writer_t* writer, FILE* stream, int capacity, int write_headers) {
+    memset(writer, 0, sizeof(block_writer_t));
+    writer->m_stream = stream;
+    writer->m_blocks = calloc(capacity, sizeof(data_block_t));
+    writer->m_headers = calloc(capacity, sizeof(block_header_t));
+    writer->m_begin = calloc(capacity, sizeof(uint64_t));
+    writer->m_end = calloc(capacity, sizeof(uint64_t));
+    writer->m_write_headers = write_headers;
+    return;
+}
+
+static void block_writer_free(block_writer_t* writer, int capacity) {
+    int i;
+
+    for(i = 0; i < capacity; i++) {
+        data_block_destroy(&writer->m_blocks[i]);
+    }
+    free(writer->m_blocks);
+    free(writer->m_headers);
+    free(writer->m_begin);
+    free(writer->m_end);
+    return;
+}
+
+/* set reader to borrow blocks from mapped file, starting at pos */
+static void block_reader_map(block_reader_t* reader, uint8_t* map, uint64_t map_size, uint64_t pos) {
+    reader->m_map = map;
+    reader->m_map_size = map_size;
+    reader->m_map_pos = pos;
+    reader->m_map_round = pos;
+    reader->m_map_released = pos;
+    return;
+}
+
+/* start a new round at pos -- blocks before the previous round have been coded, so their pages are released */
+static inline void block_reader_advance(block_reader_t* reader, uint64_t pos) {
+    reader->m_map_released = mmap_file_release(reader->m_map, reader->m_map_released, reader->m_map_round);
+    reader->m_map_round = pos;
+    return;
+}
+
+static void* read_raw_blocks(block_reader_t* reader) { /* thread for reading original data */
+    uint64_t size;
+    int n;
+
+    if(reader->m_map != NULL) { /* borrow blocks from the mapped file */
+        block_reader_advance(reader, reader->m_map_pos);
+        for(n = 0; n < reader->m_capacity && reader->m_map_pos < reader->m_map_size; n++) {
+            size = (reader->m_map_size - reader->m_map_pos < cr_split_size) ? reader->m_map_size - reader->m_map_pos : cr_split_size;
+            data_block_borrow(&reader->m_blocks[n], reader->m_map + reader->m_map_pos, size);
+            reader->m_map_pos += size;
+            reader->m_size += size;
+        }
+        mmap_file_prefetch(reader->m_map, reader->m_map_round, reader->m_map_pos);
+        reader->m_nblock = n;
+        return NULL;
+    }
+    for(n = 0; n < reader->m_capacity; n++) {
+        if(read_block(reader->m_stream, reader->m_prefix, reader->m_prefix_pos, &reader->m_blocks[n], cr_split_size) == 0) {
+            break;
+        }
+        reader->m_size += reader->m_blocks[n].m_size;
+    }
+    reader->m_nblock = n;
+    return NULL;
+}
+
+/* read a compressed block into slot n of reader, return 0 at the end of blocks */
+static inline int read_compressed_block(block_reader_t* reader, int n) {
+    block_header_t* header = &reader->m_headers[n];
+    data_block_t* block = &reader->m_blocks[n];
+    uint64_t size;
+
+    if(reader->m_map != NULL) { /* borrow block from the mapped file */
+        if(reader->m_map_size - reader->m_map_pos < sizeof(block_header_t)) {
+            return 0;
+        }
+        memcpy(header, reader->m_map + reader->m_map_pos, sizeof(block_header_t));
+        if(header->m_size == 0) {
+            return 0;
+        }
+        reader->m_map_pos += sizeof(block_header_t);
+        size = (reader->m_map_size - reader->m_map_pos < header->m_size) ? reader->m_map_size - reader->m_map_pos : header->m_size;
+        data_block_borrow(block, reader->m_map + reader->m_map_pos, size);
+        reader->m_map_pos += size;
+        if(reader->m_map_size - reader->m_map_pos < LZ_INPUT_PADDING) { /* decoders read a little past the block */
+            data_block_reserve(block, size + LZ_INPUT_PADDING);
+        }
+
+    } else {
+        if(fread(header, sizeof(block_header_t), 1, reader->m_stream) != 1 || header->m_size == 0) {
+            return 0;
+        }
+        data_block_resize(block, header->m_size);
+        block->m_size = fread(block->m_data, 1, block->m_size, reader->m_stream);
+    }
+    reader->m_size += sizeof(block_header_t) + block->m_size;
+    return 1;
+}
+
+static void* read_compressed_blocks(block_reader_t* reader) { /* thread for reading compressed blocks */
+    int n = 0;
+
+    if(reader->m_map != NULL) {
+        block_reader_advance(reader, reader->m_pending ? reader->m_map_pending : reader->m_map_pos);
+    }
+
+    /* a block without reset models continues the context of its previous block,
+     * so it is left pending to the next round
+     */
+    if(reader->m_pending) {
+        swap_xyblock(&reader->m_blocks[0], &reader->m_blocks[reader->m_nblock]);
+        reader->m_headers[0] = reader->m_headers[reader->m_nblock];
+        reader->m_pending = 0;
+        n = 1;
+    }
+    while(n < reader->m_capacity && reader->m_remain > 0) {
+        reader->m_map_pending = reader->m_map_pos;
+        if(!read_compressed_block(reader, n)) { /* end of blocks */
+            reader->m_remain = 0;
+            break;
+        }
+        reader->m_remain -= 1;
+
+        if(n > 0 && !reader->m_headers[n].m_reset) {
+            reader->m_pending = 1;
+            break;
+        }
+        n++;
+    }
+    if(reader->m_map != NULL) {
+        mmap_file_prefetch(reader->m_map, reader->m_map_round, reader->m_map_pos);
+    }
+    reader->m_nblock = n;
+    return NULL;
+}
+
+static void* write_blocks(block_writer_t* writer) { /* thread for writing blocks */
+    int i;
+
+    for(i = 0; i < writer->m_nblock; i++) {
+        if(writer->m_write_headers) {
+            fwrite(&writer->m_headers[i], sizeof(block_header_t), 1, writer->m_stream);
+        }
+        fwrite(writer->m_blocks[i].m_data + writer->m_begin[i], 1, writer->m_end[i] - writer->m_begin[i], writer->m_stream);
+    }
+    return NULL;
+}
+
+/* start writing nblock blocks of writer, block_writer_wait() before reusing them */
+static inline void block_writer_start(block_writer_t* writer, int nblock) {
+    writer->m_nblock = nblock;
+    pthread_create(&writer->m_thread, 0, (void*)write_blocks, writer);
+    writer->m_running = 1;
     return;
 }
 
-int cr_main(int argc, char** argv) {
-    struct {
-        uint32_t m_size;
-        uint8_t  m_filt;
-        uint8_t  m_prec;
-    } __attribute__((packed)) block_header;
+static inline void block_writer_wait(block_writer_t* writer) {
+    if(writer->m_running) {
+        pthread_join(writer->m_thread, 0);
+        writer->m_running = 0;
+    }
+    return;
+}
+
+/* decode blocks until the end-of-blocks marker or nblock blocks are decoded,
+ * only original data within [skip, skip + len) is written to dst_file
+ */
+static int decode_blocks(block_worker_t* workers, FILE* src_file, FILE* dst_file,
+        uint64_t nblock, uint64_t skip, uint64_t len, uint64_t* src_size, uint64_t* dst_size) {
+    block_reader_t reader;
+    block_writer_t writer;
+    uint64_t raw_pos = 0;
+    uint64_t begin;
+    uint64_t end;
+    uint8_t* map;
+    uint64_t map_size;
+    uint64_t iblock = 0;
+    int corrupted = 0;
+    int nworkers;
+    int i;
+
+    block_reader_init(&reader, src_file, cr_num_threads);
+    block_writer_init(&writer, dst_file, cr_num_threads, 0);
+    reader.m_remain = nblock;
+    if((map = mmap_file(src_file, &map_size)) != NULL) {
+        block_reader_map(&reader, map, map_size, ftello(src_file));
+    }
 
+    read_compressed_blocks(&reader); /* first round in current thread */
+    while(reader.m_nblock > 0) {
+        for(nworkers = 0; nworkers < reader.m_nblock; nworkers++) {
+            swap_xyblock(&workers[nworkers].m_ib, &reader.m_blocks[nworkers]);
+            workers[nworkers].m_header = reader.m_headers[nworkers];
+        }
+
+        /* read the next blocks while decoding */
+        pthread_create(&reader.m_thread, 0, (void*)read_compressed_blocks, &reader);
+        run_workers(workers, nworkers, decode_block_thread);
+
+        /* only blocks before a corrupted one are written */
+        for(i = 0; i < nworkers; i++) {
+            if(workers[i].m_corrupted) {
+                if(workers[i].m_header.m_reset == BLOCK_RESET_WARM && workers[i].m_snapshot == NULL) {
+                    fprintf(stderr, "block %llu: needs trained models, decode with -W.\n", (unsigned long long)(iblock + i));
+                } else {
+                    fprintf(stderr, "block %llu: corrupted.\n", (unsigned long long)(iblock + i));
+                }
+                corrupted = 1;
+                nworkers = i;
+                break;
+            }
+        }
+        iblock += nworkers;
+
+        /* write blocks in input order */
+        block_writer_wait(&writer);
+        for(i = 0; i < nworkers; i++) {
+            begin = (raw_pos > skip) ? raw_pos : skip;
+            end = (raw_pos + workers[i].m_ob.m_size < skip + len) ? raw_pos + workers[i].m_ob.m_size : skip + len;
+            if(begin > end) {
+                begin = end = raw_pos;
+            }
+            writer.m_begin[i] = begin - raw_pos;
+            writer.m_end[i] = end - raw_pos;
+            *dst_size += end - begin;
+            raw_pos += workers[i].m_ob.m_size;
+            swap_xyblock(&writer.m_blocks[i], &workers[i].m_ob);
+        }
+        block_writer_start(&writer, nworkers);
+
+        /* pass the last used context to the first worker */
+        if(nworkers > 0) {
+            block_workers_carry(workers, nworkers, 0);
+        }
+        pthread_join(reader.m_thread, 0);
+        if(corrupted) {
+            break;
+        }
+    }
+    block_writer_wait(&writer);
+    *src_size += reader.m_size;
+
+    block_reader_free(&reader);
+    block_writer_free(&writer, cr_num_threads);
+    if(map != NULL) {
+        munmap_file(map, map_size);
+    }
+    if(ferror(src_file) || ferror(dst_file)) {
+        perror("ferror()");
+        return -1;
+    }
+    return corrupted ? -1 : 0;
+}
+
+int cr_main(const lz_engine_t* engine, int argc, char** argv) {
     const char* src_name = "<stdin>";
     const char* dst_name = "<stdout>";
     FILE* src_file;
     FILE* dst_file;
-    data_block_t ib = INITIAL_BLOCK;
-    data_block_t ob = INITIAL_BLOCK;
-    data_block_t* xb;
-    data_block_t* yb;
-    uint32_t src_size;
-    uint32_t dst_size;
-    int filt = 0;
+    data_block_t prefix = INITIAL_BLOCK;
+    uint32_t prefix_pos = 0;
+    block_worker_t* workers = NULL;
+    dictionary_t* dic = NULL;
+    uint64_t src_size = 0;
+    uint64_t dst_size = 0;
+    uint32_t nblock = 0;
+    int nworkers;
+    int dic_size;
+    uint32_t dic_yb_size;
     int enc;
+    int i;
 
     data_block_t dic_xb = INITIAL_BLOCK;
     data_block_t dic_yb = INITIAL_BLOCK;
     int nword;
 
+    data_block_t snapshot = INITIAL_BLOCK;
+    int reset;
+
+    data_block_t index = INITIAL_BLOCK;
+    block_index_entry_t* entries = NULL;
+    block_index_trailer_t trailer;
+    block_header_t end_header = {0};
+    block_reader_t reader;
+    block_writer_t writer;
+    uint8_t* map;
+    uint64_t map_size;
+    uint64_t offset;
+    uint64_t length;
+    uint32_t first;
+    uint32_t last;
+    uint32_t chain;
+
     struct timeval time_start;
     struct timeval time_end;
     double cost_time;
@@ -124,86 +586,166 @@ int cr_main(int argc, char** argv) {
     setmode(fileno(stdout), O_BINARY);
 #endif
 
-    /* reset global models for compressing/decompressing */
-    reset_models();
-
     /* process arguments */
     if((argc = cr_process_arguments(argc, argv)) == 0) {
         return -1;
     }
 
+    /* init static dictionary, shared read-only by all block workers */
+    dic = malloc(sizeof(dictionary_t));
+    dictionary_init(dic);
+
+    /* init block workers, each with its own codec context */
+    workers = block_workers_create(engine, dic, cr_num_threads);
+    for(i = 0; i < cr_num_threads; i++) {
+        workers[i].m_filt_enable = cr_filt_enable;
+        workers[i].m_prec_enable = cr_prec_enable;
+    }
+
+    /* load trained models, blocks start from them instead of reset models */
+    reset = BLOCK_RESET_COLD;
+    if(cr_model_name != NULL) {
+        if(read_models(cr_model_name, engine, workers[0].m_ctx, &snapshot) != 0) {
+            fprintf(stderr, "%s\n", "read_models() failed.");
+            return -1;
+        }
+        for(i = 0; i < cr_num_threads; i++) {
+            workers[i].m_snapshot = &snapshot;
+        }
+        reset = BLOCK_RESET_WARM;
+    }
+
     /* start! */
     fprintf(stderr, "%s\n", cr_start_info);
     if(argc >=2 && argc <= 4 && strcmp(argv[1], "e") == 0) { /* encode */
         enc = 1;
         if(argc >= 3) src_name = argv[2], src_file = fopen(src_name, "rb");
         if(argc >= 4) dst_name = argv[3], dst_file = fopen(dst_name, "wb");
-        if(src_file == stdin) { /* copy input data to temporary file, since stdin doesn't support rewind() */
-            data_block_reserve(&ib, 1048576);
-            src_file = tmpfile();
-            while((ib.m_size = fread(ib.m_data, 1, ib.m_capacity, stdin)) > 0) {
-                fwrite(ib.m_data, 1, ib.m_size, src_file);
-            }
-            data_block_destroy(&ib);
-            rewind(src_file);
-            ib = INITIAL_BLOCK;
-        }
 
         if(src_file != NULL && dst_file != NULL) {
-            write_magic(dst_file);
-            fprintf(stderr, "compressing %s to %s, block_size = %uMB...\n", src_name, dst_name, cr_split_size / 1048576);
-
-            /* build static dictionary */
+            write_magic(dst_file, engine->m_magic_header);
+            fprintf(stderr, "compressing %s to %s, block_size = %uMB, threads = %d...\n",
+                    src_name, dst_name, cr_split_size / 1048576, cr_num_threads);
+
+            /* build static dictionary -- a non-seekable input (like a pipe) cannot be rewound,
+             * so the dictionary is built from its first block, which is kept for encoding.
+             * a regular file is mapped, and blocks are coded directly from the mapping
+             */
             fprintf(stderr, "%s\n", "-> building static dictionary...");
-            dicpick(src_file, &dic_xb);
-            rewind(src_file);
-            nword = dictionary_load((char*)dic_xb.m_data, 1);
+            if((map = mmap_file(src_file, &map_size)) != NULL) {
+                dicpick_map(map, map_size, &dic_xb);
+            } else if(fseek(src_file, 0, SEEK_CUR) == 0) {
+                dicpick(src_file, &dic_xb);
+                rewind(src_file);
+            } else {
+                data_block_resize(&prefix, cr_split_size);
+                prefix.m_size = fread(prefix.m_data, 1, cr_split_size, src_file);
+                dicpick_buffer(prefix.m_data, prefix.m_size, &dic_xb);
+            }
 
             /* encode static dictionary */
-            dic_lcp_encode(&dic_xb);
-            lzencode(&dic_xb, &dic_yb, 0);
-            reset_models();
-            fprintf(stderr, "added %d words to dictionary, compressed size = %u bytes\n", nword, dic_yb.m_size);
+            nword = block_dictionary_encode(&workers[0], &dic_xb, &dic_yb);
+            fprintf(stderr, "added %d words to dictionary, compressed size = %llu bytes\n", nword, (unsigned long long)dic_yb.m_size);
 
             /* write static dictionary to dst_file */
-            fwrite(&dic_yb.m_size, sizeof(dic_yb.m_size), 1, dst_file);
+            dic_yb_size = dic_yb.m_size;
+            fwrite(&dic_yb_size, sizeof(dic_yb_size), 1, dst_file);
             fwrite( dic_yb.m_data, 1, dic_yb.m_size, dst_file);
+            dst_size += strlen(engine->m_magic_header) + sizeof(dic_yb_size) + dic_yb.m_size;
             data_block_destroy(&dic_xb);
             data_block_destroy(&dic_yb);
 
-            while(!ferror(src_file) && !ferror(dst_file) && !feof(src_file)) {
-                xb = &ib;
-                yb = &ob;
-                data_block_resize(xb, cr_split_size);
+            /* read, encode and write blocks in a pipeline -- in parallel mode (or with -I) every block is coded with reset models */
+            block_reader_init(&reader, src_file, cr_num_threads);
+            block_writer_init(&writer, dst_file, cr_num_threads, 1);
+            reader.m_prefix = &prefix;
+            reader.m_prefix_pos = &prefix_pos;
+            if(map != NULL) {
+                block_reader_map(&reader, map, map_size, 0);
+            }
 
-                /* read blocks */
-                xb->m_size = fread(xb->m_data, 1, cr_split_size, src_file);
+            read_raw_blocks(&reader); /* first round in current thread */
+            while(reader.m_nblock > 0) {
+                for(nworkers = 0; nworkers < reader.m_nblock; nworkers++) {
+                    swap_xyblock(&workers[nworkers].m_ib, &reader.m_blocks[nworkers]);
+                    workers[nworkers].m_header.m_reset = (cr_num_threads > 1 || cr_independent || nblock == 0) ? reset : 0;
+                    workers[nworkers].m_raw_offset = src_size;
+                    src_size += workers[nworkers].m_ib.m_size;
+                    nblock += 1;
+                }
 
-                /* precompress with filters */
-                if(cr_filt_enable) {
-                    filt = filter_inplace(xb->m_data, xb->m_size, FILTER_ENC);
+                /* read the next blocks while encoding */
+                pthread_create(&reader.m_thread, 0, (void*)read_raw_blocks, &reader);
+                run_workers(workers, nworkers, encode_block_thread);
+
+                /* write blocks in input order */
+                block_writer_wait(&writer);
+                for(i = 0; i < nworkers; i++) {
+                    block_index_add(&index, workers[i].m_raw_offset, dst_size);
+                    writer.m_headers[i] = workers[i].m_header;
+                    writer.m_begin[i] = 0;
+                    writer.m_end[i] = workers[i].m_ob.m_size;
+                    dst_size += sizeof(block_header_t) + workers[i].m_ob.m_size;
+                    swap_xyblock(&writer.m_blocks[i], &workers[i].m_ob);
                 }
+                block_writer_start(&writer, nworkers);
+                pthread_join(reader.m_thread, 0);
+            }
+            block_writer_wait(&writer);
+            block_reader_free(&reader);
+            block_writer_free(&writer, cr_num_threads);
+            if(map != NULL) {
+                munmap_file(map, map_size);
+            }
 
-                /* encode */
-                data_block_resize(yb, 0);
-                dictionary_encode(xb, yb);
+            /* write end-of-blocks marker and block index */
+            fwrite(&end_header, sizeof(end_header), 1, dst_file);
+            dst_size += sizeof(end_header);
+            block_index_seal(&index, src_size, dst_size);
+            fwrite(index.m_data, 1, index.m_size, dst_file);
+            dst_size += index.m_size;
+            data_block_destroy(&index);
 
-                if(!cr_prec_enable) {
-                    swap_xyblock(&xb, &yb);
-                    data_block_resize(yb, 0);
-                    lzencode(xb, yb, !ferror(stderr));
-                }
+            if(ferror(src_file) || ferror(dst_file)) {
+                perror("ferror()");
+                return -1;
+            }
+        } else {
+            perror("fopen()");
+            return -1;
+        }
+        fclose(src_file);
+        fclose(dst_file);
 
-                /* write blocks */
-                if(yb->m_size > 0) {
-                    block_header.m_size = yb->m_size;
-                    block_header.m_filt = filt;
-                    block_header.m_prec = cr_prec_enable;
+    } else if(argc >= 2 && argc <= 4 && strcmp(argv[1], "t") == 0) { /* train models */
+        enc = 1;
+        if(argc >= 3) src_name = argv[2], src_file = fopen(src_name, "rb");
+        if(argc >= 4) dst_name = argv[3], dst_file = fopen(dst_name, "wb");
 
-                    fwrite(&block_header, sizeof(block_header), 1, dst_file);
-                    fwrite(yb->m_data, 1, yb->m_size, dst_file);
-                }
+        if(src_file != NULL && dst_file != NULL) {
+            fprintf(stderr, "training models with %s to %s, block_size = %uMB...\n", src_name, dst_name, cr_split_size / 1048576);
+
+            /* code all blocks in sequence with one context, the static dictionary only holds the
+             * reserved words -- small inputs the models are meant for add few. the compressed data is dropped
+             */
+            dicpick_buffer(NULL, 0, &dic_xb); /* reserved words only */
+            block_dictionary_encode(&workers[0], &dic_xb, &dic_yb);
+            data_block_destroy(&dic_xb);
+            data_block_destroy(&dic_yb);
+
+            block_reader_init(&reader, src_file, 1);
+            reader.m_prefix = &prefix;
+            reader.m_prefix_pos = &prefix_pos;
+            for(read_raw_blocks(&reader); reader.m_nblock > 0; read_raw_blocks(&reader)) {
+                swap_xyblock(&workers[0].m_ib, &reader.m_blocks[0]);
+                workers[0].m_header.m_reset = (nblock == 0) ? reset : 0;
+                src_size += workers[0].m_ib.m_size;
+                nblock += 1;
+                encode_block_thread(&workers[0]);
             }
+            block_reader_free(&reader);
+
+            dst_size = write_models(dst_file, engine, workers[0].m_ctx);
             if(ferror(src_file) || ferror(dst_file)) {
                 perror("ferror()");
                 return -1;
@@ -212,8 +754,6 @@ int cr_main(int argc, char** argv) {
             perror("fopen()");
             return -1;
         }
-        src_size = ftell(src_file);
-        dst_size = ftell(dst_file);
         fclose(src_file);
         fclose(dst_file);
 
@@ -221,85 +761,97 @@ int cr_main(int argc, char** argv) {
         enc = 0;
         if(argc >= 3) src_name = argv[2], src_file = fopen(src_name, "rb");
         if(argc >= 4) dst_name = argv[3], dst_file = fopen(dst_name, "wb");
-
-        if(src_file == stdin) { /* copy input data to temporary file, since stdin doesn't support rewind() */
-            data_block_reserve(&ib, 1048576);
-            src_file = tmpfile();
-            while((ib.m_size = fread(ib.m_data, 1, ib.m_capacity, stdin)) > 0) {
-                fwrite(ib.m_data, 1, ib.m_size, src_file);
-            }
-            data_block_destroy(&ib);
-            rewind(src_file);
-            ib = INITIAL_BLOCK;
-        }
         if(src_file != NULL && dst_file != NULL) {
-            if(!check_magic(src_file)) {
+            if(!check_magic(src_file, engine->m_magic_header)) {
                 fprintf(stderr, "%s\n", "check_magic() failed.");
                 fclose(src_file);
                 fclose(dst_file);
                 return -1;
             }
-            fprintf(stderr, "decompressing %s to %s...\n", src_name, dst_name);
+            fprintf(stderr, "decompressing %s to %s, threads = %d...\n", src_name, dst_name, cr_num_threads);
 
             /* decode static dictionary */
             fprintf(stderr, "%s\n", "-> decoding static dictionary...");
+            if((dic_size = read_dictionary(src_file, &workers[0])) < 0) {
+                fprintf(stderr, "%s\n", "read_dictionary() failed.");
+                return -1;
+            }
+            src_size += strlen(engine->m_magic_header) + dic_size;
 
-            /* read size of static dictionary from src_file */
-            fread(&dic_yb.m_size, sizeof(dic_yb.m_size), 1, src_file);
+            if(decode_blocks(workers, src_file, dst_file, UINT64_MAX, 0, UINT64_MAX, &src_size, &dst_size) != 0) {
+                fprintf(stderr, "%s\n", "decode_blocks() failed.");
+                return -1;
+            }
+        } else {
+            perror("fopen()");
+            return -1;
+        }
+        fclose(src_file);
+        fclose(dst_file);
 
-            /* read static dictionary from src_file */
-            data_block_resize(&dic_yb, dic_yb.m_size);
-            fread(dic_yb.m_data, 1, dic_yb.m_size, src_file);
+    } else if(argc >= 4 && argc <= 6 && strcmp(argv[1], "x") == 0) { /* extract */
+        enc = 0;
+        offset = strtoull(argv[2], NULL, 10);
+        length = strtoull(argv[3], NULL, 10);
+        if(argc >= 5) src_name = argv[4], src_file = fopen(src_name, "rb");
+        if(argc >= 6) dst_name = argv[5], dst_file = fopen(dst_name, "wb");
+        if(src_file != NULL && dst_file != NULL) {
+            if(!check_magic(src_file, engine->m_magic_header)) {
+                fprintf(stderr, "%s\n", "check_magic() failed.");
+                fclose(src_file);
+                fclose(dst_file);
+                return -1;
+            }
+            if(read_block_index(src_file, strlen(engine->m_magic_header), &trailer, &entries) != 0) { /* needs a seekable input */
+                fprintf(stderr, "%s\n", "read_block_index() failed.");
+                fclose(src_file);
+                fclose(dst_file);
+                return -1;
+            }
+            fprintf(stderr, "extracting %s to %s, offset = %llu, length = %llu, threads = %d...\n",
+                    src_name, dst_name, (unsigned long long)offset, (unsigned long long)length, cr_num_threads);
 
             /* decode static dictionary */
-            lzdecode(&dic_yb, &dic_xb, 0);
-            reset_models();
-            dic_lcp_decode(&dic_xb);
-
-            dictionary_load((char*)dic_xb.m_data, 0);
-            data_block_destroy(&dic_xb);
-            data_block_destroy(&dic_yb);
+            fprintf(stderr, "%s\n", "-> decoding static dictionary...");
+            fseeko(src_file, strlen(engine->m_magic_header), SEEK_SET);
+            if((dic_size = read_dictionary(src_file, &workers[0])) < 0) {
+                fprintf(stderr, "%s\n", "read_dictionary() failed.");
+                return -1;
+            }
+            src_size += strlen(engine->m_magic_header) + dic_size;
 
-            while(!ferror(src_file) && !ferror(dst_file) && !feof(src_file)) {
-                xb = &ib;
-                yb = &ob;
+            if(offset < trailer.m_raw_size && length > 0) {
+                if(length > trailer.m_raw_size - offset) {
+                    length = trailer.m_raw_size - offset;
+                }
 
-                /* read blocks */
-                if(fread(&block_header, sizeof(block_header), 1, src_file) != 1) {
-                    break;
+                /* find blocks covering [offset, offset + length) */
+                for(first = 0; first + 1 < trailer.m_nblock && entries[first + 1].m_raw_offset <= offset; first++) {
                 }
-                data_block_resize(yb, block_header.m_size);
-                yb->m_size = fread(yb->m_data, 1, yb->m_size, src_file);
-
-                /* decode */
-                if(!block_header.m_prec) {
-                    data_block_resize(xb, 0);
-                    lzdecode(yb, xb, !ferror(stderr));
-                    swap_xyblock(&xb, &yb);
+                for(last = first; last + 1 < trailer.m_nblock && entries[last + 1].m_raw_offset < offset + length; last++) {
                 }
-                data_block_resize(xb, 0);
-                dictionary_decode(yb, xb, dst_file);
 
-                /* precompress with filters */
-                if(block_header.m_filt) {
-                    filter_inplace(xb->m_data, xb->m_size, FILTER_DEC);
+                /* a block without reset models depends on its previous blocks, decode from the first independent one */
+                for(chain = first; chain > 0; chain--) {
+                    fseeko(src_file, entries[chain].m_offset, SEEK_SET);
+                    if(fread(&workers[0].m_header, sizeof(block_header_t), 1, src_file) != 1 || workers[0].m_header.m_reset) {
+                        break;
+                    }
                 }
+                fprintf(stderr, "-> decoding blocks %u..%u of %u...\n", chain, last, trailer.m_nblock);
 
-                /* write blocks */
-                if(xb->m_size > 0) {
-                    fwrite(xb->m_data, 1, xb->m_size, dst_file);
+                fseeko(src_file, entries[chain].m_offset, SEEK_SET);
+                if(decode_blocks(workers, src_file, dst_file, last - chain + 1,
+                            offset - entries[chain].m_raw_offset, length, &src_size, &dst_size) != 0) {
+                    fprintf(stderr, "%s\n", "decode_blocks() failed.");
+                    return -1;
                 }
             }
-            if(ferror(src_file) || ferror(dst_file)) {
-                perror("ferror()");
-                return -1;
-            }
+            free(entries);
         } else {
             perror("fopen()");
             return -1;
         }
-        src_size = ftell(src_file);
-        dst_size = ftell(dst_file);
         fclose(src_file);
         fclose(dst_file);
 
@@ -309,20 +861,23 @@ int cr_main(int argc, char** argv) {
         return -1;
     }
 
-    data_block_destroy(&ib);
-    data_block_destroy(&ob);
+    block_workers_destroy(workers, cr_num_threads);
+    data_block_destroy(&prefix);
+    dictionary_free(dic);
+    free(dic);
+    data_block_destroy(&snapshot);
 
     gettimeofday(&time_end, NULL);
     cost_time = (time_end.tv_sec - time_start.tv_sec) + (time_end.tv_usec - time_start.tv_usec) / 1000000.0;
 
-    fprintf(stderr, "%u bytes => %u bytes\n\n", src_size, dst_size);
+    fprintf(stderr, "%llu bytes => %llu bytes\n\n", (unsigned long long)src_size, (unsigned long long)dst_size);
     if(enc) {
-        fprintf(stderr, "encode-speed:   %.3lf MB/s\n",  src_size / 1048576 / cost_time);
+        fprintf(stderr, "encode-speed:   %.3lf MB/s\n",  src_size / 1048576.0 / cost_time);
         fprintf(stderr, "cost-time:      %.3lf s\n",     cost_time);
         fprintf(stderr, "compress-ratio: %.3lf\n",       (double)dst_size / src_size);
         fprintf(stderr, "bpb:            %.3lf\n",       (double)dst_size / src_size * 8);
     } else {
-        fprintf(stderr, "decode-speed:   %.3lf MB/s\n",  dst_size / 1048576 / cost_time);
+        fprintf(stderr, "decode-speed:   %.3lf MB/s\n",  dst_size / 1048576.0 / cost_time);
         fprintf(stderr, "cost-time:      %.3lf s\n",     cost_time);
         fprintf(stderr, "compress-ratio: %.3lf\n",       (double)src_size / dst_size);
         fprintf(stderr, "bpb:            %.3lf\n",       (double)src_size / dst_size * 8);
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2011-2012 by Zhang Li <RichSelian at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE PROJECT AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE PROJECT OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef HEADER_MINIPORT_MMAP_H
+#define HEADER_MINIPORT_MMAP_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <sys/mman.h>   /* use mmap on a unix-like platform */
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* map a regular file as private writable pages (modifications are not written back),
+ * return NULL if stream cannot be mapped
+ */
+static inline uint8_t* mmap_file(FILE* stream, uint64_t* size) {
+    struct stat st;
+    void* data;
+
+    if(fstat(fileno(stream), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0 || (uint64_t)st.st_size > SIZE_MAX) {
+        return NULL;
+    }
+    data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(stream), 0);
+    if(data == MAP_FAILED) {
+        return NULL;
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    *size = st.st_size;
+    return data;
+}
+
+static inline void munmap_file(uint8_t* data, uint64_t size) {
+    munmap(data, size);
+    return;
+}
+
+/* hint that [begin, end) will be accessed soon */
+static inline void mmap_file_prefetch(uint8_t* data, uint64_t begin, uint64_t end) {
+    uintptr_t pagesize = sysconf(_SC_PAGESIZE);
+    uintptr_t x = ((uintptr_t)(data + begin)) & ~(pagesize - 1);
+
+    if(begin < end) {
+        madvise((void*)x, (uintptr_t)(data + end) - x, MADV_WILLNEED);
+    }
+    return;
+}
+
+/* drop whole pages inside [begin, end) which will not be accessed again, modifications are discarded.
+ * return the end of released pages, which is the begin of the next release
+ */
+static inline uint64_t mmap_file_release(uint8_t* data, uint64_t begin, uint64_t end) {
+    uintptr_t pagesize = sysconf(_SC_PAGESIZE);
+    uintptr_t x = ((uintptr_t)(data + begin) + pagesize - 1) & ~(pagesize - 1);
+    uintptr_t y = ((uintptr_t)(data + end)) & ~(pagesize - 1);
+
+    if(begin < end && x < y) {
+        madvise((void*)x, y - x, MADV_DONTNEED);
+        return y - (uintptr_t)data;
+    }
+    return begin;
+}
+
+#else /* no mmap for windows -- fall back to stdio */
+static inline uint8_t* mmap_file(FILE* stream, uint64_t* size) {
+    return NULL;
+}
+static inline void munmap_file(uint8_t* data, uint64_t size) {
+    return;
+}
+static inline void mmap_file_prefetch(uint8_t* data, uint64_t begin, uint64_t end) {
+    return;
+}
+static inline uint64_t mmap_file_release(uint8_t* data, uint64_t begin, uint64_t end) {
+    return begin;
+}
+
+#endif /* #if !defined(_WIN32) && !defined(_WIN64) */
+#endif
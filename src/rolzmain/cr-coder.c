@@ -32,6 +32,10 @@
 #include "../cr-rangecoder.h"
 #include "../cr-model.h"
 #include "../cr-ppm.h"
+#include "../cr-bitlit.h"
+#include "../cr-ppmh.h"
+#include "../cr-history.h"
+#include "../cr-rans.h"
 #include "../miniport-thread.h"
 
 static void update_progress(uint32_t current, uint32_t total) {
@@ -48,53 +52,186 @@ static void update_progress(uint32_t current, uint32_t total) {
     return;
 }
 
-/* global models -- for lzencode() and lzdecode() */
-static struct {
-    model_t idx_model;
-    model_t len_model;
-    ppm_model_t ppm_model;
-} m;
-
-/* global coders -- for lzencode() and lzdecode() */
-range_coder_t coder;
-range_coder_t idx_coder;
-
 /* block header fields */
-struct {
+typedef struct block_header_t {
     uint8_t  m_firstbyte;
     uint8_t  m_compressed;
     uint8_t  m_esc;
+    uint8_t  m_rans; /* idx stream coded with static rANS tables */
+    uint8_t  m_lit_coder;
+    uint8_t  m_lit_order;  /* LIT_CODER_PPMH only */
+    uint16_t m_lit_budget; /* LIT_CODER_PPMH only, MB */
+    uint16_t m_o2_budget;  /* ppm o2 contexts, KB */
+    uint32_t m_history;    /* history window (MB) kept after this block */
     uint32_t m_original_size;
     uint32_t m_num_idx;
+    uint32_t m_num_lit;    /* literal stream symbols coded, the ones after them are stored raw */
+    uint32_t m_offset_raw;
     uint32_t m_offset_idx;
-}
-block_header;
+} block_header_t;
+
+/* codec context -- for lzencode() and lzdecode() */
+struct lz_context_t {
+    struct {
+        nmodel_t idx_model;
+        nmodel_t len_model;
+        ppm_model_t ppm_model;
+        bitlit_model_t bitlit_model;
+        ppmh_model_t ppmh_model;
+    } m;
+
+    range_coder_t coder;
+    range_coder_t idx_coder;
+    rans_table_t rans_tables[2]; /* len, idx */
+    rans_decoder_t rans_idx;
+    block_header_t block_header;
+    data_block_t history; /* tail of earlier blocks, see cr-history.h */
+    data_block_t* snapshot; /* trained models of the last lz_context_load(), NULL after a reset */
+};
 
 /* common model initializer */
-static inline void atexit_free_models() {
-    ppm_model_free(&m.ppm_model);
+lz_context_t* lz_context_create() {
+    lz_context_t* ctx = calloc(1, sizeof(lz_context_t));
+
+    lz_context_reset(ctx);
+    return ctx;
+}
+
+void lz_context_destroy(lz_context_t* ctx) {
+    ppm_model_free(&ctx->m.ppm_model);
+    ppmh_model_free(&ctx->m.ppmh_model);
+    data_block_destroy(&ctx->history);
+    free(ctx);
     return;
 }
-void reset_models() {
+
+void lz_context_reset(lz_context_t* ctx) {
     int i;
-    int register_atexit = 0;
 
-    if(!register_atexit) {
-        atexit(atexit_free_models);
-        register_atexit = 1;
-    }
-    ppm_model_free(&m.ppm_model);
-    ppm_model_init(&m.ppm_model);
+    ppm_model_free(&ctx->m.ppm_model);
+    ppm_model_init(&ctx->m.ppm_model);
+    bitlit_model_init(&ctx->m.bitlit_model);
+    ppmh_model_restart(&ctx->m.ppmh_model);
+    data_block_resize(&ctx->history, 0);
+    ctx->snapshot = NULL;
 
     for(i = 0; i < 256; i++) {
-        m.idx_model.m_frq_table[i] = (i < M_rolz_indices + M_rolz_indices_short);
-        m.len_model.m_frq_table[i] = (i == 0 || (i >= M_rolz_minlength && i <= M_rolz_maxlength));
+        ctx->m.idx_model.m_adaptive.m_frq_table[i] = (i < M_rolz_indices + M_rolz_indices_short);
+        ctx->m.len_model.m_adaptive.m_frq_table[i] = (i == 0 || (i >= M_rolz_minlength && i <= M_rolz_maxlength));
+    }
+    nmodel_recalc(&ctx->m.idx_model);
+    nmodel_recalc(&ctx->m.len_model);
+    return;
+}
+
+/* warm start -- the ppm model and the side models, as trained by earlier input */
+void lz_context_save(lz_context_t* ctx, data_block_t* snapshot) {
+    ppm_model_save(&ctx->m.ppm_model, snapshot);
+    data_block_append(snapshot, &ctx->m.idx_model, sizeof(ctx->m.idx_model));
+    data_block_append(snapshot, &ctx->m.len_model, sizeof(ctx->m.len_model));
+    data_block_append(snapshot, &ctx->m.bitlit_model, sizeof(ctx->m.bitlit_model));
+    return;
+}
+
+int lz_context_load(lz_context_t* ctx, data_block_t* snapshot) {
+    uint8_t* data = snapshot->m_data;
+    uint8_t* end = snapshot->m_data + snapshot->m_size;
+
+    lz_context_reset(ctx);
+    if(ppm_model_load(&ctx->m.ppm_model, &data, end) != 0
+            || (uint64_t)(end - data) != sizeof(ctx->m.idx_model) + sizeof(ctx->m.len_model) + sizeof(ctx->m.bitlit_model)) {
+        lz_context_reset(ctx);
+        return -1;
+    }
+    memcpy(&ctx->m.idx_model, data, sizeof(ctx->m.idx_model));
+    data += sizeof(ctx->m.idx_model);
+    memcpy(&ctx->m.len_model, data, sizeof(ctx->m.len_model));
+    data += sizeof(ctx->m.len_model);
+    memcpy(&ctx->m.bitlit_model, data, sizeof(ctx->m.bitlit_model));
+    data += sizeof(ctx->m.bitlit_model);
+    ctx->snapshot = snapshot;
+    return 0;
+}
+
+/* back to the models the block chain started from -- trained ones after a warm start */
+static inline void lz_context_restart(lz_context_t* ctx) {
+    if(ctx->snapshot != NULL) {
+        lz_context_load(ctx, ctx->snapshot);
+    } else {
+        lz_context_reset(ctx);
+    }
+    return;
+}
+
+/* code a literal stream symbol with the literal coder of the block */
+static inline void lit_encode(lz_context_t* ctx, range_coder_t* coder, int c, data_block_t* o_block) {
+    if(ctx->block_header.m_lit_coder == LIT_CODER_BIT) {
+        bitlit_encode(coder, &ctx->m.bitlit_model, ctx->m.ppm_model.context, c, o_block);
+    } else if(ctx->block_header.m_lit_coder == LIT_CODER_CM) {
+        ppm_cm_encode(coder, &ctx->m.ppm_model, c, o_block);
+    } else if(ctx->block_header.m_lit_coder == LIT_CODER_PPMH) {
+        ppmh_encode(coder, &ctx->m.ppmh_model, ctx->m.ppm_model.context, c, o_block);
+    } else {
+        ppm_encode(coder, &ctx->m.ppm_model, c, o_block);
     }
-    model_recalc_cum(&m.idx_model);
-    model_recalc_cum(&m.len_model);
     return;
 }
 
+/* code the next literal stream symbol, or store it raw once the block gave up coding literals */
+static inline void lit_encode_next(lz_context_t* ctx, int c, data_block_t* o_block, data_block_t* raw_block) {
+    if(raw_block != NULL) {
+        data_block_add(raw_block, c);
+        return;
+    }
+    lit_encode(ctx, &ctx->coder, c, o_block);
+    ctx->block_header.m_num_lit += 1;
+    return;
+}
+
+/* code a run of literal bytes (or store it raw), updating the context */
+static inline void lit_encode_run(lz_context_t* ctx, uint8_t* data, int len, data_block_t* o_block, data_block_t* raw_block) {
+    int i;
+
+    if(raw_block == NULL && ctx->block_header.m_lit_coder == LIT_CODER_PPM) {
+        ppm_encode_run(&ctx->coder, &ctx->m.ppm_model, data, len, o_block);
+        ctx->block_header.m_num_lit += len;
+        return;
+    }
+    for(i = 0; i < len; i++) {
+        lit_encode_next(ctx, data[i], o_block, raw_block);
+        ppm_update_context(&ctx->m.ppm_model, data[i]);
+    }
+    return;
+}
+
+static inline int lit_decode(lz_context_t* ctx, range_coder_t* coder, uint8_t** input) {
+    if(ctx->block_header.m_lit_coder == LIT_CODER_BIT) {
+        return bitlit_decode(coder, &ctx->m.bitlit_model, ctx->m.ppm_model.context, input);
+    }
+    if(ctx->block_header.m_lit_coder == LIT_CODER_CM) {
+        return ppm_cm_decode(coder, &ctx->m.ppm_model, input);
+    }
+    if(ctx->block_header.m_lit_coder == LIT_CODER_PPMH) {
+        return ppmh_decode(coder, &ctx->m.ppmh_model, ctx->m.ppm_model.context, input);
+    }
+    return ppm_decode(coder, &ctx->m.ppm_model, input);
+}
+
+/* decode the next literal stream symbol, raw ones follow the coded ones. -1 past the end of its stream */
+static inline int lit_decode_next(lz_context_t* ctx, uint8_t** input, uint8_t* input_end, uint8_t** input_raw, uint8_t* raw_end) {
+    int c;
+
+    if(ctx->block_header.m_num_lit == 0) {
+        return (*input_raw < raw_end) ? *(*input_raw)++ : -1;
+    }
+    if(*input > input_end) { /* a symbol reads at most a few bytes, so padding covers the overrun */
+        return -1;
+    }
+    c = lit_decode(ctx, &ctx->coder, input);
+    ctx->block_header.m_num_lit -= 1;
+    return c;
+}
+
 /* pthread-callback wrapper */
 typedef struct lzmatch_thread_param_pack_t {
     matcher_t*      m_matcher;
@@ -136,11 +273,54 @@ static void* lzmatch_thread(lzmatch_thread_param_pack_t* args) { /* thread for f
     return NULL;
 }
 
-void lzencode(data_block_t* ib, data_block_t* ob, int print_information) {
+/* the idx stream is recorded as (model, symbol) pairs while matching and coded after it */
+static inline void idx_record(data_block_t* pairs, int model, int symbol) {
+    data_block_add(pairs, model);
+    data_block_add(pairs, symbol);
+    return;
+}
+
+/* code the idx stream with the adaptive models, or with static rANS tables unless they cost more
+ * than 1/32 extra. a rANS coded stream leaves the adaptive models as they were, like the decoder does */
+static void idx_encode(lz_context_t* ctx, data_block_t* pairs, data_block_t* o_block) {
+    data_block_t rans_block = INITIAL_BLOCK;
+    nmodel_t len_model = ctx->m.len_model;
+    nmodel_t idx_model = ctx->m.idx_model;
+    uint64_t i;
+
+    for(i = 0; i < pairs->m_size; i += 2) {
+        if(pairs->m_data[i] == 0) {
+            M_nm_enc_(ctx->idx_coder, o_block, ctx->m.len_model, pairs->m_data[i + 1], 4);
+        } else {
+            M_nm_enc_(ctx->idx_coder, o_block, ctx->m.idx_model, pairs->m_data[i + 1], 4);
+        }
+    }
+    range_encoder_flush(&ctx->idx_coder, o_block);
+    rans_encode(pairs, 2, &rans_block);
+
+    if(rans_block.m_size <= o_block->m_size + o_block->m_size / 32) {
+        data_block_resize(o_block, rans_block.m_size);
+        memcpy(o_block->m_data, rans_block.m_data, rans_block.m_size);
+        ctx->m.len_model = len_model;
+        ctx->m.idx_model = idx_model;
+        ctx->block_header.m_rans = 1;
+    }
+    data_block_destroy(&rans_block);
+    return;
+}
+
+void lzencode(lz_context_t* ctx, data_block_t* ib, data_block_t* ob, int print_information) {
     uint32_t     i;
     uint32_t     match_idx;
     uint32_t     match_len;
     data_block_t idx_block = INITIAL_BLOCK;
+    data_block_t idx_pairs = INITIAL_BLOCK;
+    data_block_t hb = INITIAL_BLOCK;
+    data_block_t raw_block = INITIAL_BLOCK;
+    data_block_t* raw = NULL;
+    uint32_t     hlen;
+    uint64_t     lit_size;
+    int          probed = 0;
     uint32_t     pos = 1;
     uint32_t     counter[256] = {0};
     int          esc = 0;
@@ -158,14 +338,40 @@ void lzencode(data_block_t* ib, data_block_t* ob, int print_information) {
         fprintf(stderr, "%s\n", "-> running ROLZ encoding...");
     }
 
-    /* configure matcher */
-    using_ctx4 = ib->m_size >= 4194304;
-    matcher_init(&matcher);
+    /* configure matcher -- fill it with the history, coding starts after it */
+    matcher_init(&matcher, ib->m_size >= 4194304);
+    hlen = history_usable(&ctx->history, ib->m_size);
+    history_join(&ctx->history, hlen, ib, &hb);
+    for(i = 0; i <= hlen; i++) {
+        matcher_update(&matcher, hb.m_data, i, 1);
+    }
+    pos = hlen + 1;
+    pool_pos = hlen + 1;
 
     /* reserve space for block header */
-    data_block_resize(ob, sizeof(block_header));
-    block_header.m_num_idx = 0;
-    block_header.m_firstbyte = ib->m_data[0];
+    data_block_resize(ob, sizeof(block_header_t));
+    ctx->block_header.m_num_idx = 0;
+    ctx->block_header.m_num_lit = 0;
+    ctx->block_header.m_rans = 0;
+    ctx->block_header.m_lit_coder = lit_coder;
+    ctx->block_header.m_lit_order = 0;
+    ctx->block_header.m_lit_budget = 0;
+    ctx->block_header.m_history = history_window;
+    ctx->block_header.m_o2_budget = ppm_o2_budget;
+    if(ppm_model_setup(&ctx->m.ppm_model, ppm_o2_budget) == -1) { /* no memory for the o2 arena, store the block */
+        goto CannotCompress_nojoin_nofree;
+    }
+    if(lit_coder == LIT_CODER_PPMH) {
+        ctx->block_header.m_lit_order = ppmh_order;
+        ctx->block_header.m_lit_budget = ppmh_budget;
+        if(ppmh_model_setup(&ctx->m.ppmh_model, ppmh_order, ppmh_budget) == -1) { /* no memory for the budget, use ppm */
+            ctx->block_header.m_lit_coder = LIT_CODER_PPM;
+        }
+    }
+    if(lit_coder == LIT_CODER_CM && ppm_cm_setup(&ctx->m.ppm_model) == -1) { /* no memory for the tables, use ppm */
+        ctx->block_header.m_lit_coder = LIT_CODER_PPM;
+    }
+    ctx->block_header.m_firstbyte = ib->m_data[0];
 
     /* find escape */
     for(i = 0; i < ib->m_size; i++) {
@@ -176,14 +382,14 @@ void lzencode(data_block_t* ib, data_block_t* ob, int print_information) {
             esc = i;
         }
     }
-    block_header.m_esc = esc;
+    ctx->block_header.m_esc = esc;
 
-    range_encoder_init(&coder);
-    range_encoder_init(&idx_coder);
+    range_encoder_init(&ctx->coder);
+    range_encoder_init(&ctx->idx_coder);
 
     /* init matching thread */
     thread_args.m_matcher = &matcher;
-    thread_args.m_iblock = ib;
+    thread_args.m_iblock = &hb;
     thread_args.m_pos = &pool_pos;
     thread_args.m_pool_len = pool_len[0];
     thread_args.m_pool_idx = pool_idx[0]; lzmatch_thread(&thread_args);
@@ -194,9 +400,9 @@ void lzencode(data_block_t* ib, data_block_t* ob, int print_information) {
      * match =  2
      * eof =    0
      */
-    while(pos < ib->m_size) {
+    while(pos < hb.m_size) {
         if(print_information) {
-            update_progress(pos, ib->m_size);
+            update_progress(pos - hlen, ib->m_size);
         }
 
         if(pool_index == M_match_rets_size) { /* start the next matching thread */
@@ -212,85 +418,127 @@ void lzencode(data_block_t* ib, data_block_t* ob, int print_information) {
         pool_index += 1;
 
         if(match_idx != -1) { /* ROLZ match */
-            ppm_encode(&coder, &m.ppm_model, esc, ob);
-            M_my_enc_(idx_coder, &idx_block, m.len_model, match_len, 4);
-            M_my_enc_(idx_coder, &idx_block, m.idx_model, match_idx, 4);
-            block_header.m_num_idx += 1;
+            lit_encode_next(ctx, esc, ob, raw);
+            idx_record(&idx_pairs, 0, match_len);
+            idx_record(&idx_pairs, 1, match_idx);
+            ctx->block_header.m_num_idx += 1;
 
-        } else { /* literal */
-            ppm_encode(&coder, &m.ppm_model, ib->m_data[pos], ob);
-            if(ib->m_data[pos] == esc) {
-                M_my_enc_(idx_coder, &idx_block, m.len_model, 0, 4);
-                block_header.m_num_idx += 1;
+            for(i = 0; i < match_len; i++) { /* update context */
+                ppm_update_context(&ctx->m.ppm_model, hb.m_data[pos++]);
+            }
+
+        } else { /* literal -- code it with the following literals of this pool as one run */
+            while(pool_index < M_match_rets_size && pool_idx[pool_n][pool_index] == -1 && pos + match_len < hb.m_size) {
+                pool_index += 1;
+                match_len += 1;
+            }
+            lit_encode_run(ctx, hb.m_data + pos, match_len, ob, raw);
+            for(i = 0; i < match_len; i++) {
+                if(hb.m_data[pos++] == esc) {
+                    idx_record(&idx_pairs, 0, 0);
+                    ctx->block_header.m_num_idx += 1;
+                }
             }
-        }
-        for(i = 0; i < match_len; i++) { /* update context */
-            ppm_update_context(&m.ppm_model, ib->m_data[pos++]);
         }
 
-        if(ob->m_size >= ib->m_size) { /* cannot compress */
+        lit_size = ob->m_size - sizeof(block_header_t);
+        if(lit_size + raw_block.m_size >= ib->m_size) { /* cannot compress */
             goto CannotCompress;
         }
+        if(!probed && pos - hlen >= ib->m_size / 2) { /* the first half did not compress -- store the rest of literals raw if it looks no better */
+            probed = 1;
+            if(lit_size >= pos - hlen && ppm_incompressible(hb.m_data + pos, hb.m_size - pos)) {
+                raw = &raw_block; /* matches are still found and coded */
+            }
+        }
     }
     pthread_join(thread, 0);
     matcher_free(&matcher);
+    history_update(&ctx->history, ib->m_data, ib->m_size, history_window * 1048576);
+    data_block_destroy(&hb);
 
-    range_encoder_flush(&coder, ob);
-    range_encoder_flush(&idx_coder, &idx_block);
+    range_encoder_flush(&ctx->coder, ob);
+    idx_encode(ctx, &idx_pairs, &idx_block);
 
     /* set block header */
-    block_header.m_compressed = 1;
-    block_header.m_original_size = ib->m_size;
-    block_header.m_offset_idx = ob->m_size;
-    memcpy(ob->m_data, &block_header, sizeof(block_header));
+    ctx->block_header.m_compressed = 1;
+    ctx->block_header.m_original_size = ib->m_size;
+    ctx->block_header.m_offset_raw = ob->m_size;
+    data_block_append(ob, raw_block.m_data, raw_block.m_size);
+    data_block_destroy(&raw_block);
+    ctx->block_header.m_offset_idx = ob->m_size;
+    memcpy(ob->m_data, &ctx->block_header, sizeof(block_header_t));
 
     /* append extra blocks to ob */
     data_block_resize(ob, ob->m_size + idx_block.m_size);
-    memcpy(ob->m_data + block_header.m_offset_idx, idx_block.m_data, idx_block.m_size);
+    memcpy(ob->m_data + ctx->block_header.m_offset_idx, idx_block.m_data, idx_block.m_size);
     data_block_destroy(&idx_block);
+    data_block_destroy(&idx_pairs);
     return;
 
 CannotCompress:
     pthread_join(thread, 0);
     matcher_free(&matcher);
 
-    data_block_resize(ob, sizeof(block_header) + ib->m_size);
-    memset(ob->m_data, 0, sizeof(block_header));
+CannotCompress_nojoin_nofree:
+    lz_context_restart(ctx); /* the models saw part of the block, the decoder of a stored block starts over too */
+    history_update(&ctx->history, ib->m_data, ib->m_size, history_window * 1048576);
+    data_block_destroy(&hb);
+    data_block_destroy(&raw_block);
+
+    data_block_resize(ob, sizeof(block_header_t) + ib->m_size);
+    memset(&ctx->block_header, 0, sizeof(block_header_t));
+    ctx->block_header.m_history = history_window;
+    memcpy(ob->m_data, &ctx->block_header, sizeof(block_header_t));
     for(i = 0; i < ib->m_size; i++) {
-        ob->m_data[sizeof(block_header) + i] = ib->m_data[i];
+        ob->m_data[sizeof(block_header_t) + i] = ib->m_data[i];
     }
     data_block_destroy(&idx_block);
+    data_block_destroy(&idx_pairs);
     return;
 }
 
 /* pthread-callback wrapper */
 typedef struct lzdecode_thread_param_pack_t {
+    lz_context_t* m_ctx;
     uint32_t* m_idx_queue;
     uint32_t* m_len_queue;
     uint8_t** m_input_idx;
+    uint8_t*  m_input_end;
 } lzdecode_thread_param_pack_t;
 
 #define M_idx_queue_size   10000
 
 static void* lzdecode_idx_thread(lzdecode_thread_param_pack_t* args) { /* thread for decoding idx/len */
+    lz_context_t* ctx = args->m_ctx;
     decode_symbol_t decode_helper;
     uint32_t i;
 
     /* decode idx */
-    for(i = 0; block_header.m_num_idx > 0 && i < M_idx_queue_size; i++) {
-        block_header.m_num_idx--;
-        args->m_len_queue[i] =                            M_my_dec_(idx_coder, *args->m_input_idx, m.len_model, 4);
-        args->m_idx_queue[i] = args->m_len_queue[i] > 0 ? M_my_dec_(idx_coder, *args->m_input_idx, m.idx_model, 4) : 0;
+    for(i = 0; ctx->block_header.m_num_idx > 0 && i < M_idx_queue_size && *args->m_input_idx <= args->m_input_end; i++) {
+        ctx->block_header.m_num_idx--;
+        if(ctx->block_header.m_rans) {
+            args->m_len_queue[i] =                            rans_decode(&ctx->rans_idx, &ctx->rans_tables[0], args->m_input_idx);
+            args->m_idx_queue[i] = args->m_len_queue[i] > 0 ? rans_decode(&ctx->rans_idx, &ctx->rans_tables[1], args->m_input_idx) : 0;
+            continue;
+        }
+        args->m_len_queue[i] =                            M_nm_dec_(ctx->idx_coder, *args->m_input_idx, ctx->m.len_model, 4);
+        args->m_idx_queue[i] = args->m_len_queue[i] > 0 ? M_nm_dec_(ctx->idx_coder, *args->m_input_idx, ctx->m.idx_model, 4) : 0;
     }
+    memset(args->m_len_queue + i, 0, (M_idx_queue_size - i) * sizeof(uint32_t)); /* never read uninitialized items */
+    memset(args->m_idx_queue + i, 0, (M_idx_queue_size - i) * sizeof(uint32_t));
     return 0;
 }
-void lzdecode(data_block_t* ib, data_block_t* ob, int print_information) {
+int lzdecode(lz_context_t* ctx, data_block_t* ib, data_block_t* ob, int print_information) {
     uint32_t match_idx;
     uint32_t match_len;
     uint32_t i;
     uint32_t pos;
     unsigned char* input;
+    unsigned char* input_raw;
     unsigned char* input_idx;
+    unsigned char* input_end = ib->m_data + ib->m_size;
+    uint32_t hlen;
 
     matcher_t matcher;
     pthread_t thread;
@@ -299,46 +547,91 @@ void lzdecode(data_block_t* ib, data_block_t* ob, int print_information) {
     uint32_t idx_n = 0;
     uint32_t idx_queue[2][M_idx_queue_size];
     uint32_t len_queue[2][M_idx_queue_size];
-    uint32_t decode_symbol;
+    int      decode_symbol;
 
     if(print_information) {
         fprintf(stderr, "%s\n", "-> running ROLZ decoding...");
     }
-
-    memcpy(&block_header, ib->m_data, sizeof(block_header));
-    if(!block_header.m_compressed) {
-        for(i = sizeof(block_header); i < ib->m_size; i++) { /* data not compressed, no need to decompress */
+    if(ib->m_size < sizeof(block_header_t)) {
+        return -1;
+    }
+    memcpy(&ctx->block_header, ib->m_data, sizeof(block_header_t));
+    if(ctx->block_header.m_history > HISTORY_MAX_WINDOW) {
+        return -1;
+    }
+    if(!ctx->block_header.m_compressed) {
+        for(i = sizeof(block_header_t); i < ib->m_size; i++) { /* data not compressed, no need to decompress */
             data_block_add(ob, ib->m_data[i]);
         }
-        return;
+        lz_context_restart(ctx);
+        history_update(&ctx->history, ob->m_data, ob->m_size, ctx->block_header.m_history * 1048576);
+        return 0;
+    }
+    if(ctx->block_header.m_lit_coder > LIT_CODER_PPMH) {
+        return -1;
+    }
+    if(ctx->block_header.m_lit_coder == LIT_CODER_PPMH && (
+                ctx->block_header.m_lit_order < 1 || ctx->block_header.m_lit_order > PPMH_MAX_ORDER ||
+                ctx->block_header.m_lit_budget < 1 || ctx->block_header.m_lit_budget > PPMH_MAX_BUDGET ||
+                ppmh_model_setup(&ctx->m.ppmh_model, ctx->block_header.m_lit_order, ctx->block_header.m_lit_budget) == -1)) {
+        return -1;
+    }
+    if(ppm_model_setup(&ctx->m.ppm_model, ctx->block_header.m_o2_budget) == -1) { /* bad budget, or no memory for it */
+        return -1;
+    }
+    if(ctx->block_header.m_lit_coder == LIT_CODER_CM && ppm_cm_setup(&ctx->m.ppm_model) == -1) {
+        return -1;
+    }
+    if(ctx->block_header.m_offset_raw < sizeof(block_header_t)
+            || ctx->block_header.m_offset_idx < ctx->block_header.m_offset_raw
+            || ctx->block_header.m_offset_idx > ib->m_size) {
+        return -1;
+    }
+    /* configure matcher -- decode behind the history, matches may refer to it */
+    matcher_init(&matcher, ctx->block_header.m_original_size >= 4194304);
+    hlen = history_usable(&ctx->history, ctx->block_header.m_original_size);
+    history_prefix(&ctx->history, hlen, ob);
+    data_block_reserve(ob, hlen + ctx->block_header.m_original_size);
+    data_block_resize(ob, hlen + 1);
+    ob->m_data[hlen] = ctx->block_header.m_firstbyte;
+    for(i = 0; i <= hlen; i++) {
+        matcher_update(&matcher, ob->m_data, i, 0);
     }
-    data_block_reserve(ob, block_header.m_original_size);
-    data_block_resize(ob, 1);
-    ob->m_data[0] = block_header.m_firstbyte;
-
-    /* configure matcher */
-    using_ctx4 = (block_header.m_original_size >= 4194304);
-    matcher_init(&matcher);
 
-    input = ib->m_data + sizeof(block_header);
-    input_idx = ib->m_data + block_header.m_offset_idx;
+    input = ib->m_data + sizeof(block_header_t);
+    input_raw = ib->m_data + ctx->block_header.m_offset_raw;
+    input_idx = ib->m_data + ctx->block_header.m_offset_idx;
 
-    range_decoder_init(&coder, &input);
-    range_decoder_init(&idx_coder, &input_idx);
+    range_decoder_init(&ctx->coder, &input);
+    if(ctx->block_header.m_rans) {
+        if(rans_decoder_init(&ctx->rans_idx, ctx->rans_tables, 2, &input_idx, input_end) != 0) {
+            matcher_free(&matcher);
+            return -1;
+        }
+    } else {
+        range_decoder_init(&ctx->idx_coder, &input_idx);
+    }
 
     /* init threads */
+    thread_args.m_ctx = ctx;
     thread_args.m_input_idx = &input_idx;
+    thread_args.m_input_end = input_end;
     thread_args.m_len_queue = len_queue[0];
     thread_args.m_idx_queue = idx_queue[0]; lzdecode_idx_thread(&thread_args);
     thread_args.m_len_queue = len_queue[1];
     thread_args.m_idx_queue = idx_queue[1]; pthread_create(&thread, 0, (void*)lzdecode_idx_thread, &thread_args);
 
-    while(ob->m_size < block_header.m_original_size) {
+    while(ob->m_size - hlen < ctx->block_header.m_original_size) {
         if(print_information) {
-            update_progress(ob->m_size, block_header.m_original_size);
+            update_progress(ob->m_size - hlen, ctx->block_header.m_original_size);
         }
 
-        if((decode_symbol = ppm_decode(&coder, &m.ppm_model, &input)) == block_header.m_esc) { /* escape */
+        decode_symbol = lit_decode_next(ctx, &input, input_end, &input_raw, ib->m_data + ctx->block_header.m_offset_idx);
+        if(decode_symbol == -1) {
+            goto Corrupted;
+        }
+
+        if(decode_symbol == ctx->block_header.m_esc) { /* escape */
             if(idx_index >= M_idx_queue_size) { /* decode length (from queue) */
                 pthread_join(thread, 0);
                 thread_args.m_len_queue = len_queue[idx_n];
@@ -352,11 +645,14 @@ void lzdecode(data_block_t* ib, data_block_t* ob, int print_information) {
             idx_index++;
 
             if(match_len == 0) { /* escape character */
-                data_block_add(ob, block_header.m_esc);
+                data_block_add(ob, ctx->block_header.m_esc);
                 match_len = 1;
 
             } else { /* ROLZ match */
                 pos = matcher_getpos(&matcher, match_idx);
+                if(pos >= ob->m_size || match_len > ctx->block_header.m_original_size - (ob->m_size - hlen)) {
+                    goto Corrupted;
+                }
                 for(i = 0; i < match_len; i++) {
                     data_block_add(ob, ob->m_data[pos + i]);
                 }
@@ -369,11 +665,34 @@ void lzdecode(data_block_t* ib, data_block_t* ob, int print_information) {
 
         while(match_len > 0) {
             matcher_update(&matcher, ob->m_data, ob->m_size - match_len, 0);
-            ppm_update_context(&m.ppm_model, ob->m_data[ob->m_size - match_len]);
+            ppm_update_context(&ctx->m.ppm_model, ob->m_data[ob->m_size - match_len]);
             match_len--;
         }
     }
     pthread_join(thread, 0);
     matcher_free(&matcher);
-    return;
+
+    if(input > input_end || input_idx > input_end) {
+        return -1;
+    }
+    history_strip(&ctx->history, hlen, ob, ctx->block_header.m_history * 1048576);
+    return 0;
+
+Corrupted:
+    pthread_join(thread, 0);
+    matcher_free(&matcher);
+    return -1;
 }
+
+/* engine descriptor */
+const lz_engine_t lz_engine_rolz = {
+    "comprolz",
+    "\x1f\x9d\x01\x01::0.25.0-comprolz",
+    lz_context_create,
+    lz_context_reset,
+    lz_context_destroy,
+    lz_context_save,
+    lz_context_load,
+    lzencode,
+    lzdecode,
+};
@@ -29,19 +29,18 @@
 #include "cr-matcher.h"
 
 int flexible_parsing = 0;
-int using_ctx4 = 0;
 
 #define M_table_elem(n)     (matcher->m_table[n])
 #define M_table_item(x, n)  (M_table_elem(x).m_item[(M_table_elem(x).m_head + M_rolz_indices - (n)) % M_rolz_indices])
 #define M_table_hash(x, n)  (M_table_elem(x).m_hash[(M_table_elem(x).m_head + M_rolz_indices - (n)) % M_rolz_indices])
 
-static inline uint32_t M_rolz_hash_ctx(unsigned char* x) {
-    return using_ctx4
+static inline uint32_t M_rolz_hash_ctx(matcher_t* matcher, unsigned char* x) {
+    return matcher->m_ctx4
         ? (uint32_t)(x[0] * 1313131 + x[-1] * 13131 + x[-2] * 131 + x[-3]) % M_rolz_buckets
         : (uint32_t)(x[0] * 1313131 + x[-1] * 13131 + x[-2] * 131        ) % M_rolz_buckets;
 }
 
-int matcher_init(matcher_t* matcher) {
+int matcher_init(matcher_t* matcher, int using_ctx4) {
     uint32_t i;
 
     if((matcher->m_table = malloc(M_rolz_buckets * sizeof(matcher->m_table[0]))) != NULL) {
@@ -49,6 +48,7 @@ int matcher_init(matcher_t* matcher) {
         for(i = 0; i < M_rolz_buckets; i++) {
             M_table_elem(i).m_head = 0;
         }
+        matcher->m_ctx4 = using_ctx4;
         matcher->m_context = 0;
         memset(matcher->m_short_table, 0, sizeof(matcher->m_short_table));
         matcher->m_short_context = 0;
@@ -71,7 +71,7 @@ int matcher_update(matcher_t* matcher, unsigned char* data, uint32_t pos, int en
     if(encode) {
         M_table_hash(matcher->m_context, 0) = data[pos];
     }
-    matcher->m_context = M_rolz_hash_ctx(data + pos);
+    matcher->m_context = M_rolz_hash_ctx(matcher, data + pos);
 
     memmove(matcher->m_short_table[matcher->m_short_context] + 1,
             matcher->m_short_table[matcher->m_short_context], (M_rolz_indices_short - 1) * sizeof(uint32_t));
@@ -84,7 +84,10 @@ int matcher_getpos(matcher_t* matcher, uint32_t idx) {
     if(idx < M_rolz_indices) {
         return M_table_item(matcher->m_context, idx);
     }
-    return matcher->m_short_table[matcher->m_short_context][idx - M_rolz_indices];
+    if(idx < M_rolz_indices + M_rolz_indices_short) {
+        return matcher->m_short_table[matcher->m_short_context][idx - M_rolz_indices];
+    }
+    return -1; /* only in corrupted input */
 }
 
 static matcher_ret_t match(matcher_t* matcher, unsigned char* data, uint32_t pos, uint32_t context, int minlen) {
@@ -148,7 +151,7 @@ matcher_ret_t matcher_lookup(matcher_t* matcher, unsigned char* data, uint32_t p
 #define M_price(i, l)   ((l) >= M_rolz_minlength ? (M_price_ml((l)-1)) - 3*(i) : M_price_ul(1))
 
         for(i = 1; i <= ret.m_len; i++) {
-            ret2 = match(matcher, data, pos + i, M_rolz_hash_ctx(data + pos + i - 1), M_rolz_minlength);
+            ret2 = match(matcher, data, pos + i, M_rolz_hash_ctx(matcher, data + pos + i - 1), M_rolz_minlength);
             prices[i] = M_price(ret2.m_idx, ret2.m_len);
         }
         maxprice = M_price(ret.m_idx, ret.m_len) + prices[ret.m_len];
@@ -185,7 +188,7 @@ matcher_ret_t matcher_lookup(matcher_t* matcher, unsigned char* data, uint32_t p
     /* lazy parsing */
     if((!flexible_parsing || find_short) && ret.m_len > 1) {
         for(i = 1; i < M_rolz_minlength; i++) {
-            ret2 = match(matcher, data, pos + i, M_rolz_hash_ctx(data + pos + i - 1), M_rolz_minlength);
+            ret2 = match(matcher, data, pos + i, M_rolz_hash_ctx(matcher, data + pos + i - 1), M_rolz_minlength);
             if(M_price(ret2.m_idx, ret2.m_len) > M_price(ret.m_idx, ret.m_len) + i * M_rolz_indices) {
                 ret.m_idx = -1;
                 ret.m_len = 1;
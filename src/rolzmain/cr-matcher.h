@@ -41,9 +41,9 @@
 #define M_rolz_maxlength        255
 
 extern int flexible_parsing;
-extern int using_ctx4;
 
 typedef struct matcher_t {
+    uint32_t m_ctx4;
     uint32_t m_context;
     struct {
         uint32_t m_head;
@@ -60,7 +60,7 @@ typedef struct matcher_ret_t {
     uint32_t m_len;
 } matcher_ret_t;
 
-int matcher_init(matcher_t* matcher);
+int matcher_init(matcher_t* matcher, int using_ctx4);
 int matcher_free(matcher_t* matcher);
 int matcher_update(matcher_t* matcher, unsigned char* data, uint32_t pos, int encode);
 int matcher_getpos(matcher_t* matcher, uint32_t idx);
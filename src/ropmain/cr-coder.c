@@ -32,6 +32,9 @@
 #include "../cr-rangecoder.h"
 #include "../cr-model.h"
 #include "../cr-ppm.h"
+#include "../cr-bitlit.h"
+#include "../cr-ppmh.h"
+#include "../cr-history.h"
 #include "../miniport-thread.h"
 
 static void update_progress(uint32_t current, uint32_t total) {
@@ -48,40 +51,163 @@ static void update_progress(uint32_t current, uint32_t total) {
     return;
 }
 
-/* global models -- for lzencode() and lzdecode() */
-static struct {
-    ppm_model_t ppm_model;
-} m;
-
-/* global coders -- for lzencode() and lzdecode() */
-range_coder_t coder;
-
 /* block header fields */
-struct {
+typedef struct block_header_t {
     uint8_t  m_compressed;
     uint32_t m_original_size;
     uint8_t  m_esc;
+    uint8_t  m_lit_coder;
+    uint8_t  m_lit_order;  /* LIT_CODER_PPMH only */
+    uint16_t m_lit_budget; /* LIT_CODER_PPMH only, MB */
+    uint16_t m_o2_budget;  /* ppm o2 contexts, KB */
+    uint32_t m_history;    /* history window (MB) kept after this block */
     uint8_t  m_firstbytes[9];
-}
-block_header;
+    uint32_t m_num_lit;    /* literal stream symbols coded, the ones after them are stored raw */
+    uint32_t m_offset_raw;
+} block_header_t;
+
+/* codec context -- for lzencode() and lzdecode() */
+struct lz_context_t {
+    struct {
+        ppm_model_t ppm_model;
+        bitlit_model_t bitlit_model;
+        ppmh_model_t ppmh_model;
+    } m;
+
+    range_coder_t coder;
+    block_header_t block_header;
+    data_block_t history; /* tail of earlier blocks, see cr-history.h */
+    data_block_t* snapshot; /* trained models of the last lz_context_load(), NULL after a reset */
+};
 
 /* common model initializer */
-static inline void atexit_free_models() {
-    ppm_model_free(&m.ppm_model);
+lz_context_t* lz_context_create() {
+    lz_context_t* ctx = calloc(1, sizeof(lz_context_t));
+
+    lz_context_reset(ctx);
+    return ctx;
+}
+
+void lz_context_destroy(lz_context_t* ctx) {
+    ppm_model_free(&ctx->m.ppm_model);
+    ppmh_model_free(&ctx->m.ppmh_model);
+    data_block_destroy(&ctx->history);
+    free(ctx);
+    return;
+}
+
+void lz_context_reset(lz_context_t* ctx) {
+    ppm_model_free(&ctx->m.ppm_model);
+    ppm_model_init(&ctx->m.ppm_model);
+    bitlit_model_init(&ctx->m.bitlit_model);
+    ppmh_model_restart(&ctx->m.ppmh_model);
+    data_block_resize(&ctx->history, 0);
+    ctx->snapshot = NULL;
     return;
 }
-void reset_models() {
-    int register_atexit = 0;
 
-    if(!register_atexit) {
-        atexit(atexit_free_models);
-        register_atexit = 1;
+/* warm start -- the ppm model and the side models, as trained by earlier input */
+void lz_context_save(lz_context_t* ctx, data_block_t* snapshot) {
+    ppm_model_save(&ctx->m.ppm_model, snapshot);
+    data_block_append(snapshot, &ctx->m.bitlit_model, sizeof(ctx->m.bitlit_model));
+    return;
+}
+
+int lz_context_load(lz_context_t* ctx, data_block_t* snapshot) {
+    uint8_t* data = snapshot->m_data;
+    uint8_t* end = snapshot->m_data + snapshot->m_size;
+
+    lz_context_reset(ctx);
+    if(ppm_model_load(&ctx->m.ppm_model, &data, end) != 0
+            || (uint64_t)(end - data) != sizeof(ctx->m.bitlit_model)) {
+        lz_context_reset(ctx);
+        return -1;
+    }
+    memcpy(&ctx->m.bitlit_model, data, sizeof(ctx->m.bitlit_model));
+    data += sizeof(ctx->m.bitlit_model);
+    ctx->snapshot = snapshot;
+    return 0;
+}
+
+/* back to the models the block chain started from -- trained ones after a warm start */
+static inline void lz_context_restart(lz_context_t* ctx) {
+    if(ctx->snapshot != NULL) {
+        lz_context_load(ctx, ctx->snapshot);
+    } else {
+        lz_context_reset(ctx);
     }
-    ppm_model_free(&m.ppm_model);
-    ppm_model_init(&m.ppm_model);
     return;
 }
 
+/* code a literal stream symbol with the literal coder of the block */
+static inline void lit_encode(lz_context_t* ctx, range_coder_t* coder, int c, data_block_t* o_block) {
+    if(ctx->block_header.m_lit_coder == LIT_CODER_BIT) {
+        bitlit_encode(coder, &ctx->m.bitlit_model, ctx->m.ppm_model.context, c, o_block);
+    } else if(ctx->block_header.m_lit_coder == LIT_CODER_CM) {
+        ppm_cm_encode(coder, &ctx->m.ppm_model, c, o_block);
+    } else if(ctx->block_header.m_lit_coder == LIT_CODER_PPMH) {
+        ppmh_encode(coder, &ctx->m.ppmh_model, ctx->m.ppm_model.context, c, o_block);
+    } else {
+        ppm_encode(coder, &ctx->m.ppm_model, c, o_block);
+    }
+    return;
+}
+
+/* code the next literal stream symbol, or store it raw once the block gave up coding literals */
+static inline void lit_encode_next(lz_context_t* ctx, int c, data_block_t* o_block, data_block_t* raw_block) {
+    if(raw_block != NULL) {
+        data_block_add(raw_block, c);
+        return;
+    }
+    lit_encode(ctx, &ctx->coder, c, o_block);
+    ctx->block_header.m_num_lit += 1;
+    return;
+}
+
+/* code a run of literal bytes (or store it raw), updating the context */
+static inline void lit_encode_run(lz_context_t* ctx, uint8_t* data, int len, data_block_t* o_block, data_block_t* raw_block) {
+    int i;
+
+    if(raw_block == NULL && ctx->block_header.m_lit_coder == LIT_CODER_PPM) {
+        ppm_encode_run(&ctx->coder, &ctx->m.ppm_model, data, len, o_block);
+        ctx->block_header.m_num_lit += len;
+        return;
+    }
+    for(i = 0; i < len; i++) {
+        lit_encode_next(ctx, data[i], o_block, raw_block);
+        ppm_update_context(&ctx->m.ppm_model, data[i]);
+    }
+    return;
+}
+
+static inline int lit_decode(lz_context_t* ctx, range_coder_t* coder, uint8_t** input) {
+    if(ctx->block_header.m_lit_coder == LIT_CODER_BIT) {
+        return bitlit_decode(coder, &ctx->m.bitlit_model, ctx->m.ppm_model.context, input);
+    }
+    if(ctx->block_header.m_lit_coder == LIT_CODER_CM) {
+        return ppm_cm_decode(coder, &ctx->m.ppm_model, input);
+    }
+    if(ctx->block_header.m_lit_coder == LIT_CODER_PPMH) {
+        return ppmh_decode(coder, &ctx->m.ppmh_model, ctx->m.ppm_model.context, input);
+    }
+    return ppm_decode(coder, &ctx->m.ppm_model, input);
+}
+
+/* decode the next literal stream symbol, raw ones follow the coded ones. -1 past the end of its stream */
+static inline int lit_decode_next(lz_context_t* ctx, uint8_t** input, uint8_t* input_end, uint8_t** input_raw, uint8_t* raw_end) {
+    int c;
+
+    if(ctx->block_header.m_num_lit == 0) {
+        return (*input_raw < raw_end) ? *(*input_raw)++ : -1;
+    }
+    if(*input > input_end) { /* a symbol reads at most a few bytes, so padding covers the overrun */
+        return -1;
+    }
+    c = lit_decode(ctx, &ctx->coder, input);
+    ctx->block_header.m_num_lit -= 1;
+    return c;
+}
+
 /* pthread-callback wrapper */
 typedef struct lzmatch_thread_param_pack_t {
     matcher_t*      m_matcher;
@@ -116,13 +242,19 @@ static void* lzmatch_thread(lzmatch_thread_param_pack_t* args) { /* thread for f
     args->m_pos[0] = pos;
     return NULL;
 }
-void lzencode(data_block_t* ib, data_block_t* ob, int print_information) {
+void lzencode(lz_context_t* ctx, data_block_t* ib, data_block_t* ob, int print_information) {
     matcher_t matcher;
     uint32_t  match_len;
     uint32_t  i;
     uint32_t  pos;
     uint32_t  counter[256] = {0};
     int       esc = 0;
+    data_block_t hb = INITIAL_BLOCK;
+    data_block_t raw_block = INITIAL_BLOCK;
+    data_block_t* raw = NULL;
+    uint32_t  hlen;
+    uint64_t  lit_size;
+    int       probed = 0;
 
     lzmatch_thread_param_pack_t thread_args;
     pthread_t thread;
@@ -136,12 +268,12 @@ void lzencode(data_block_t* ib, data_block_t* ob, int print_information) {
     }
 
     /* reserve space for block header */
-    data_block_resize(ob, sizeof(block_header));
+    data_block_resize(ob, sizeof(block_header_t));
     if(ib->m_size < 16) {
         goto CannotCompress_nojoin_nofree;
     }
     for(pos = 0; pos < 9; pos++) {
-        block_header.m_firstbytes[pos] = ib->m_data[pos];
+        ctx->block_header.m_firstbytes[pos] = ib->m_data[pos];
     }
 
     /* find escape */
@@ -153,22 +285,48 @@ void lzencode(data_block_t* ib, data_block_t* ob, int print_information) {
             esc = i;
         }
     }
-    block_header.m_esc = esc;
+    ctx->block_header.m_esc = esc;
+    ctx->block_header.m_lit_coder = lit_coder;
+    ctx->block_header.m_lit_order = 0;
+    ctx->block_header.m_lit_budget = 0;
+    ctx->block_header.m_history = history_window;
+    ctx->block_header.m_num_lit = 0;
+    ctx->block_header.m_o2_budget = ppm_o2_budget;
+    if(ppm_model_setup(&ctx->m.ppm_model, ppm_o2_budget) == -1) { /* no memory for the o2 arena, store the block */
+        goto CannotCompress_nojoin_nofree;
+    }
+    if(lit_coder == LIT_CODER_PPMH) {
+        ctx->block_header.m_lit_order = ppmh_order;
+        ctx->block_header.m_lit_budget = ppmh_budget;
+        if(ppmh_model_setup(&ctx->m.ppmh_model, ppmh_order, ppmh_budget) == -1) { /* no memory for the budget, use ppm */
+            ctx->block_header.m_lit_coder = LIT_CODER_PPM;
+        }
+    }
+    if(lit_coder == LIT_CODER_CM && ppm_cm_setup(&ctx->m.ppm_model) == -1) { /* no memory for the tables, use ppm */
+        ctx->block_header.m_lit_coder = LIT_CODER_PPM;
+    }
 
+    /* fill the matcher with the history, coding starts after it */
     matcher_init(&matcher);
-    range_encoder_init(&coder);
+    hlen = history_usable(&ctx->history, ib->m_size);
+    history_join(&ctx->history, hlen, ib, &hb);
+    for(i = 9; i < hlen + 9; i++) {
+        matcher_update(&matcher, hb.m_data, i);
+    }
+    pos = hlen + 9;
+    range_encoder_init(&ctx->coder);
 
     /* start thread (matching first block) */
     match_nextpos = pos;
     thread_args.m_pos = &match_nextpos;
-    thread_args.m_iblock = ib;
+    thread_args.m_iblock = &hb;
     thread_args.m_matcher = &matcher;
     thread_args.m_lens = match_lens[0]; lzmatch_thread(&thread_args);
     thread_args.m_lens = match_lens[1]; pthread_create(&thread, 0, (void*)lzmatch_thread, &thread_args);
 
-    while(pos < ib->m_size) {
+    while(pos < hb.m_size) {
         if(print_information) {
-            update_progress(pos, ib->m_size);
+            update_progress(pos - hlen, ib->m_size);
         }
 
         /* find match */
@@ -183,36 +341,56 @@ void lzencode(data_block_t* ib, data_block_t* ob, int print_information) {
 
         /* encode a (esc+len) or a single literal */
         if(match_len > 1) {
-            ppm_encode(&coder, &m.ppm_model, esc, ob);
-            ppm_update_context(&m.ppm_model, esc);
-            ppm_encode(&coder, &m.ppm_model, match_len, ob);
-
-        } else {
-            ppm_encode(&coder, &m.ppm_model, ib->m_data[pos], ob);
-            if(ib->m_data[pos] == esc) {
-                ppm_update_context(&m.ppm_model, esc);
-                ppm_encode(&coder, &m.ppm_model, 0, ob);
+            lit_encode_next(ctx, esc, ob, raw);
+            ppm_update_context(&ctx->m.ppm_model, esc);
+            lit_encode_next(ctx, match_len, ob, raw);
+
+        } else if(hb.m_data[pos] == esc) { /* (esc+0) */
+            lit_encode_next(ctx, esc, ob, raw);
+            ppm_update_context(&ctx->m.ppm_model, esc);
+            lit_encode_next(ctx, 0, ob, raw);
+
+        } else { /* literal -- code it with the following non-esc literals of this batch as one run */
+            while(match_retindex < M_match_rets_size && match_lens[match_retn][match_retindex] == 1
+                    && pos + match_len < hb.m_size && hb.m_data[pos + match_len] != esc) {
+                match_retindex += 1;
+                match_len += 1;
             }
+            lit_encode_run(ctx, hb.m_data + pos, match_len, ob, raw);
+            pos += match_len;
+            match_len = 0;
         }
 
         while(match_len > 0) { /* update context */
-            ppm_update_context(&m.ppm_model, ib->m_data[pos]);
+            ppm_update_context(&ctx->m.ppm_model, hb.m_data[pos]);
             pos++;
             match_len--;
         }
 
-        if(ob->m_size >= ib->m_size) { /* cannot compress */
+        lit_size = ob->m_size - sizeof(block_header_t);
+        if(lit_size + raw_block.m_size >= ib->m_size) { /* cannot compress */
             goto CannotCompress;
         }
+        if(!probed && pos - hlen >= ib->m_size / 2) { /* the first half did not compress -- store the rest of literals raw if it looks no better */
+            probed = 1;
+            if(lit_size >= pos - hlen && ppm_incompressible(hb.m_data + pos, hb.m_size - pos)) {
+                raw = &raw_block; /* matches are still found and coded */
+            }
+        }
     }
     pthread_join(thread, 0);
     matcher_free(&matcher);
-    range_encoder_flush(&coder, ob);
+    history_update(&ctx->history, ib->m_data, ib->m_size, history_window * 1048576);
+    data_block_destroy(&hb);
+    range_encoder_flush(&ctx->coder, ob);
 
     /* set block header */
-    block_header.m_compressed = 1;
-    block_header.m_original_size = ib->m_size;
-    memcpy(ob->m_data, &block_header, sizeof(block_header));
+    ctx->block_header.m_compressed = 1;
+    ctx->block_header.m_original_size = ib->m_size;
+    ctx->block_header.m_offset_raw = ob->m_size;
+    data_block_append(ob, raw_block.m_data, raw_block.m_size);
+    data_block_destroy(&raw_block);
+    memcpy(ob->m_data, &ctx->block_header, sizeof(block_header_t));
     return;
 
 CannotCompress:
@@ -220,62 +398,116 @@ CannotCompress:
     matcher_free(&matcher);
 
 CannotCompress_nojoin_nofree:
-    data_block_resize(ob, sizeof(block_header) + ib->m_size);
-    memset(ob->m_data, 0, sizeof(block_header));
+    lz_context_restart(ctx); /* the models saw part of the block, the decoder of a stored block starts over too */
+    history_update(&ctx->history, ib->m_data, ib->m_size, history_window * 1048576);
+    data_block_destroy(&hb);
+    data_block_destroy(&raw_block);
+    data_block_resize(ob, sizeof(block_header_t) + ib->m_size);
+    memset(&ctx->block_header, 0, sizeof(block_header_t));
+    ctx->block_header.m_history = history_window;
+    memcpy(ob->m_data, &ctx->block_header, sizeof(block_header_t));
     for(i = 0; i < ib->m_size; i++) {
-        ob->m_data[sizeof(block_header) + i] = ib->m_data[i];
+        ob->m_data[sizeof(block_header_t) + i] = ib->m_data[i];
     }
     return;
 }
 
-void lzdecode(data_block_t* ib, data_block_t* ob, int print_information) {
+int lzdecode(lz_context_t* ctx, data_block_t* ib, data_block_t* ob, int print_information) {
     uint32_t        match_pos;
     uint32_t        match_len;
     uint32_t        i;
     unsigned char*  input;
+    unsigned char*  input_end = ib->m_data + ib->m_size;
+    unsigned char*  input_raw;
     matcher_t       matcher;
-    uint32_t        decode_symbol;
+    int             decode_symbol;
+    uint32_t        hlen;
 
     if(print_information) {
         fprintf(stderr, "%s\n", "-> running LZP/ARI decoding...");
     }
-
-    memcpy(&block_header, ib->m_data, sizeof(block_header));
-    if(!block_header.m_compressed) {
-        for(i = sizeof(block_header); i < ib->m_size; i++) { /* data not compressed, no need to decompress */
+    if(ib->m_size < sizeof(block_header_t)) {
+        return -1;
+    }
+    memcpy(&ctx->block_header, ib->m_data, sizeof(block_header_t));
+    if(ctx->block_header.m_history > HISTORY_MAX_WINDOW) {
+        return -1;
+    }
+    if(!ctx->block_header.m_compressed) {
+        for(i = sizeof(block_header_t); i < ib->m_size; i++) { /* data not compressed, no need to decompress */
             data_block_add(ob, ib->m_data[i]);
         }
-        return;
+        lz_context_restart(ctx);
+        history_update(&ctx->history, ob->m_data, ob->m_size, ctx->block_header.m_history * 1048576);
+        return 0;
+    }
+    if(ctx->block_header.m_lit_coder > LIT_CODER_PPMH) {
+        return -1;
+    }
+    if(ctx->block_header.m_lit_coder == LIT_CODER_PPMH && (
+                ctx->block_header.m_lit_order < 1 || ctx->block_header.m_lit_order > PPMH_MAX_ORDER ||
+                ctx->block_header.m_lit_budget < 1 || ctx->block_header.m_lit_budget > PPMH_MAX_BUDGET ||
+                ppmh_model_setup(&ctx->m.ppmh_model, ctx->block_header.m_lit_order, ctx->block_header.m_lit_budget) == -1)) {
+        return -1;
     }
-    data_block_reserve(ob, block_header.m_original_size);
+    if(ppm_model_setup(&ctx->m.ppm_model, ctx->block_header.m_o2_budget) == -1) { /* bad budget, or no memory for it */
+        return -1;
+    }
+    if(ctx->block_header.m_lit_coder == LIT_CODER_CM && ppm_cm_setup(&ctx->m.ppm_model) == -1) {
+        return -1;
+    }
+    /* decode behind the history, matches may refer to it */
+    hlen = history_usable(&ctx->history, ctx->block_header.m_original_size);
+    history_prefix(&ctx->history, hlen, ob);
+    data_block_reserve(ob, hlen + ctx->block_header.m_original_size);
 
-    data_block_resize(ob, 9);
+    data_block_resize(ob, hlen + 9);
     for(i = 0; i < 9; i++) {
-        ob->m_data[i] = block_header.m_firstbytes[i];
+        ob->m_data[hlen + i] = ctx->block_header.m_firstbytes[i];
     }
-    input = ib->m_data + sizeof(block_header);
+    if(ctx->block_header.m_offset_raw < sizeof(block_header_t) || ctx->block_header.m_offset_raw > ib->m_size) {
+        return -1;
+    }
+    input = ib->m_data + sizeof(block_header_t);
+    input_raw = ib->m_data + ctx->block_header.m_offset_raw;
     matcher_init(&matcher);
-    range_decoder_init(&coder, &input);
+    for(i = 9; i < hlen + 9; i++) {
+        matcher_update(&matcher, ob->m_data, i);
+    }
+    range_decoder_init(&ctx->coder, &input);
 
-    while(ob->m_size < block_header.m_original_size) {
+    while(ob->m_size - hlen < ctx->block_header.m_original_size) {
         if(print_information) {
-            update_progress(ob->m_size, block_header.m_original_size);
+            update_progress(ob->m_size - hlen, ctx->block_header.m_original_size);
         }
 
         match_len = 1;
-        decode_symbol = ppm_decode(&coder, &m.ppm_model, &input);
+        decode_symbol = lit_decode_next(ctx, &input, input_end, &input_raw, input_end);
+        if(decode_symbol == -1) {
+            matcher_free(&matcher);
+            return -1;
+        }
 
-        if(decode_symbol != block_header.m_esc) { /* literal */
+        if(decode_symbol != ctx->block_header.m_esc) { /* literal */
             data_block_add(ob, decode_symbol);
         } else {
-            ppm_update_context(&m.ppm_model, decode_symbol);
-            match_len = ppm_decode(&coder, &m.ppm_model, &input);
+            ppm_update_context(&ctx->m.ppm_model, decode_symbol);
+            decode_symbol = lit_decode_next(ctx, &input, input_end, &input_raw, input_end);
+            if(decode_symbol == -1) {
+                matcher_free(&matcher);
+                return -1;
+            }
+            match_len = decode_symbol;
 
             if(match_len == 0) { /* escape? */
                 match_len = 1;
-                data_block_add(ob, block_header.m_esc);
+                data_block_add(ob, ctx->block_header.m_esc);
             } else { /* match */
                 match_pos = matcher_getpos(&matcher, ob->m_data, ob->m_size);
+                if(match_len > ctx->block_header.m_original_size - (ob->m_size - hlen)) {
+                    matcher_free(&matcher);
+                    return -1;
+                }
                 for(i = 0; i < match_len; i++) {
                     data_block_add(ob, ob->m_data[match_pos + i]);
                 }
@@ -283,10 +515,29 @@ void lzdecode(data_block_t* ib, data_block_t* ob, int print_information) {
         }
 
         while(match_len > 0) {
-            ppm_update_context(&m.ppm_model, ob->m_data[ob->m_size - match_len]);
+            ppm_update_context(&ctx->m.ppm_model, ob->m_data[ob->m_size - match_len]);
             matcher_update(&matcher, ob->m_data, ob->m_size - match_len);
             match_len--;
         }
     }
-    return;
+    matcher_free(&matcher);
+
+    if(input > input_end) {
+        return -1;
+    }
+    history_strip(&ctx->history, hlen, ob, ctx->block_header.m_history * 1048576);
+    return 0;
 }
+
+/* engine descriptor */
+const lz_engine_t lz_engine_rop = {
+    "comprop",
+    "\x1f\x9d\x01\x01::0.25.0-comprop",
+    lz_context_create,
+    lz_context_reset,
+    lz_context_destroy,
+    lz_context_save,
+    lz_context_load,
+    lzencode,
+    lzdecode,
+};
@@ -31,7 +31,12 @@
 #include "../cr-datablock.h"
 #include "../cr-rangecoder.h"
 #include "../cr-model.h"
+#include "../cr-fmodel.h"
 #include "../cr-ppm.h"
+#include "../cr-bitlit.h"
+#include "../cr-ppmh.h"
+#include "../cr-history.h"
+#include "../cr-rans.h"
 #include "../miniport-thread.h"
 
 static void update_progress(uint32_t current, uint32_t total) {
@@ -51,68 +56,213 @@ static void update_progress(uint32_t current, uint32_t total) {
 /* increment factor for skew coding */
 #define M_inc_factor(i) (1<<(i)<<(i))
 
-/* global models -- for lzencode() and lzdecode() */
-static struct {
-    ppm_model_t ppm_model;
-    model_t len_model;
-    model_t pos_models[6];
-    model_t spos_model;
-} m;
-
-/* global coders -- for lzencode() and lzdecode() */
-range_coder_t coder;
-range_coder_t coder_pos;
-range_coder_t coder_len;
-range_coder_t coder_spos;
+/* side streams, bits in block_header_t.m_rans */
+#define M_side_spos 1
+#define M_side_pos  2
+#define M_side_len  4
 
 /* block header fields */
-struct {
+typedef struct block_header_t {
     uint8_t  m_compressed;
     uint8_t  m_match_min;
     uint8_t  m_esc;
+    uint8_t  m_rans;
+    uint8_t  m_lit_coder;
+    uint8_t  m_lit_order;  /* LIT_CODER_PPMH only */
+    uint16_t m_lit_budget; /* LIT_CODER_PPMH only, MB */
+    uint16_t m_o2_budget;  /* ppm o2 contexts, KB */
+    uint32_t m_history;    /* history window (MB) kept after this block */
     uint32_t m_original_size;
     uint32_t m_num_spos;
     uint32_t m_num_pos;
     uint32_t m_num_len;
+    uint32_t m_num_lit;    /* literal stream symbols coded, the ones after them are stored raw */
+    uint32_t m_offset_raw;
     uint32_t m_offset_spos;
     uint32_t m_offset_pos;
     uint32_t m_offset_len;
-}
-block_header;
+} block_header_t;
+
+/* codec context -- for lzencode() and lzdecode() */
+struct lz_context_t {
+    struct {
+        ppm_model_t ppm_model;
+        bitlit_model_t bitlit_model;
+        ppmh_model_t ppmh_model;
+        fmodel_t len_model; /* large increments would renormalize too often */
+        nmodel_t pos_models[6];
+        nmodel_t spos_model;
+    } m;
+
+    range_coder_t coder;
+    range_coder_t coder_pos;
+    range_coder_t coder_len;
+    range_coder_t coder_spos;
+    rans_table_t rans_pos_tables[6];
+    rans_table_t rans_len_table;
+    rans_table_t rans_spos_table;
+    rans_decoder_t rans_pos;
+    rans_decoder_t rans_len;
+    rans_decoder_t rans_spos;
+    block_header_t block_header;
+    data_block_t history; /* tail of earlier blocks, see cr-history.h */
+    data_block_t* snapshot; /* trained models of the last lz_context_load(), NULL after a reset */
+};
 
 /* common model initializer */
-static inline void atexit_free_models() {
-    ppm_model_free(&m.ppm_model);
+lz_context_t* lz_context_create() {
+    lz_context_t* ctx = calloc(1, sizeof(lz_context_t));
+
+    lz_context_reset(ctx);
+    return ctx;
+}
+
+void lz_context_destroy(lz_context_t* ctx) {
+    ppm_model_free(&ctx->m.ppm_model);
+    ppmh_model_free(&ctx->m.ppmh_model);
+    data_block_destroy(&ctx->history);
+    free(ctx);
     return;
 }
-void reset_models() {
+
+void lz_context_reset(lz_context_t* ctx) {
     int i;
     int k;
-    int register_atexit = 0;
 
-    if(!register_atexit) {
-        atexit(atexit_free_models);
-        register_atexit = 1;
-    }
-    ppm_model_free(&m.ppm_model);
-    ppm_model_init(&m.ppm_model);
+    ppm_model_free(&ctx->m.ppm_model);
+    ppm_model_init(&ctx->m.ppm_model);
+    bitlit_model_init(&ctx->m.bitlit_model);
+    ppmh_model_restart(&ctx->m.ppmh_model);
+    data_block_resize(&ctx->history, 0);
+    ctx->snapshot = NULL;
 
     for(i = 0; i < 5; i++) {        /* init pos models */
         for(k = 0; k < 256; k++) {
-            m.pos_models[i].m_frq_table[k] = (i == 0 && k % 8 == 0) || (i > 0 && ((i < 2 && k < 256) || (i < 5 && k < 128)));
+            ctx->m.pos_models[i].m_adaptive.m_frq_table[k] = (i == 0 && k % 8 == 0) || (i > 0 && ((i < 2 && k < 256) || (i < 5 && k < 128)));
         }
-        model_recalc_cum(&m.pos_models[i]);
+        nmodel_recalc(&ctx->m.pos_models[i]);
     }
-    model_init(&m.pos_models[5]);
+    nmodel_init(&ctx->m.pos_models[5]);
 
     for(k = 0; k < 256; k++) {     /* init len model */
-        m.len_model.m_frq_table[k] = (k >= match_min_near && k <= match_max) || (k == 0);
+        ctx->m.len_model.m_frq_table[k] = (k >= match_min_near && k <= match_max) || (k == 0);
+    }
+    fmodel_recalc_cum(&ctx->m.len_model);
+    nmodel_init(&ctx->m.spos_model);
+    return;
+}
+
+/* warm start -- the ppm model and the side models, as trained by earlier input */
+void lz_context_save(lz_context_t* ctx, data_block_t* snapshot) {
+    ppm_model_save(&ctx->m.ppm_model, snapshot);
+    data_block_append(snapshot, &ctx->m.bitlit_model, sizeof(ctx->m.bitlit_model));
+    data_block_append(snapshot, &ctx->m.len_model, sizeof(ctx->m.len_model));
+    data_block_append(snapshot, &ctx->m.pos_models, sizeof(ctx->m.pos_models));
+    data_block_append(snapshot, &ctx->m.spos_model, sizeof(ctx->m.spos_model));
+    return;
+}
+
+int lz_context_load(lz_context_t* ctx, data_block_t* snapshot) {
+    uint8_t* data = snapshot->m_data;
+    uint8_t* end = snapshot->m_data + snapshot->m_size;
+
+    lz_context_reset(ctx);
+    if(ppm_model_load(&ctx->m.ppm_model, &data, end) != 0
+            || (uint64_t)(end - data) != sizeof(ctx->m.bitlit_model) + sizeof(ctx->m.len_model) + sizeof(ctx->m.pos_models) + sizeof(ctx->m.spos_model)) {
+        lz_context_reset(ctx);
+        return -1;
+    }
+    memcpy(&ctx->m.bitlit_model, data, sizeof(ctx->m.bitlit_model));
+    data += sizeof(ctx->m.bitlit_model);
+    memcpy(&ctx->m.len_model, data, sizeof(ctx->m.len_model));
+    data += sizeof(ctx->m.len_model);
+    memcpy(&ctx->m.pos_models, data, sizeof(ctx->m.pos_models));
+    data += sizeof(ctx->m.pos_models);
+    memcpy(&ctx->m.spos_model, data, sizeof(ctx->m.spos_model));
+    data += sizeof(ctx->m.spos_model);
+    ctx->snapshot = snapshot;
+    return 0;
+}
+
+/* back to the models the block chain started from -- trained ones after a warm start */
+static inline void lz_context_restart(lz_context_t* ctx) {
+    if(ctx->snapshot != NULL) {
+        lz_context_load(ctx, ctx->snapshot);
+    } else {
+        lz_context_reset(ctx);
     }
-    model_recalc_cum(&m.len_model);
-    model_init(&m.spos_model);
     return;
 }
 
+/* code a literal stream symbol with the literal coder of the block */
+static inline void lit_encode(lz_context_t* ctx, range_coder_t* coder, int c, data_block_t* o_block) {
+    if(ctx->block_header.m_lit_coder == LIT_CODER_BIT) {
+        bitlit_encode(coder, &ctx->m.bitlit_model, ctx->m.ppm_model.context, c, o_block);
+    } else if(ctx->block_header.m_lit_coder == LIT_CODER_CM) {
+        ppm_cm_encode(coder, &ctx->m.ppm_model, c, o_block);
+    } else if(ctx->block_header.m_lit_coder == LIT_CODER_PPMH) {
+        ppmh_encode(coder, &ctx->m.ppmh_model, ctx->m.ppm_model.context, c, o_block);
+    } else {
+        ppm_encode(coder, &ctx->m.ppm_model, c, o_block);
+    }
+    return;
+}
+
+/* code the next literal stream symbol, or store it raw once the block gave up coding literals */
+static inline void lit_encode_next(lz_context_t* ctx, int c, data_block_t* o_block, data_block_t* raw_block) {
+    if(raw_block != NULL) {
+        data_block_add(raw_block, c);
+        return;
+    }
+    lit_encode(ctx, &ctx->coder, c, o_block);
+    ctx->block_header.m_num_lit += 1;
+    return;
+}
+
+/* code a run of literal bytes (or store it raw), updating the context */
+static inline void lit_encode_run(lz_context_t* ctx, uint8_t* data, int len, data_block_t* o_block, data_block_t* raw_block) {
+    int i;
+
+    if(raw_block == NULL && ctx->block_header.m_lit_coder == LIT_CODER_PPM) {
+        ppm_encode_run(&ctx->coder, &ctx->m.ppm_model, data, len, o_block);
+        ctx->block_header.m_num_lit += len;
+        return;
+    }
+    for(i = 0; i < len; i++) {
+        lit_encode_next(ctx, data[i], o_block, raw_block);
+        ppm_update_context(&ctx->m.ppm_model, data[i]);
+    }
+    return;
+}
+
+static inline int lit_decode(lz_context_t* ctx, range_coder_t* coder, uint8_t** input) {
+    if(ctx->block_header.m_lit_coder == LIT_CODER_BIT) {
+        return bitlit_decode(coder, &ctx->m.bitlit_model, ctx->m.ppm_model.context, input);
+    }
+    if(ctx->block_header.m_lit_coder == LIT_CODER_CM) {
+        return ppm_cm_decode(coder, &ctx->m.ppm_model, input);
+    }
+    if(ctx->block_header.m_lit_coder == LIT_CODER_PPMH) {
+        return ppmh_decode(coder, &ctx->m.ppmh_model, ctx->m.ppm_model.context, input);
+    }
+    return ppm_decode(coder, &ctx->m.ppm_model, input);
+}
+
+/* decode the next literal stream symbol, raw ones follow the coded ones. -1 past the end of its stream */
+static inline int lit_decode_next(lz_context_t* ctx, uint8_t** input, uint8_t* input_end, uint8_t** input_raw, uint8_t* raw_end) {
+    int c;
+
+    if(ctx->block_header.m_num_lit == 0) {
+        return (*input_raw < raw_end) ? *(*input_raw)++ : -1;
+    }
+    if(*input > input_end) { /* a symbol reads at most a few bytes, so padding covers the overrun */
+        return -1;
+    }
+    c = lit_decode(ctx, &ctx->coder, input);
+    ctx->block_header.m_num_lit -= 1;
+    return c;
+}
+
 /* pthread-callback wrapper */
 typedef struct lzmatch_thread_param_pack_t {
     matcher_t*      m_matcher;
@@ -150,10 +300,72 @@ static void* lzmatch_thread(lzmatch_thread_param_pack_t* args) { /* thread for f
     return NULL;
 }
 
-void lzencode(data_block_t* ib, data_block_t* ob, int print_information) {
+/* side streams are recorded as (model, symbol) pairs while matching and coded after it */
+static inline void side_record(data_block_t* pairs, int model, int symbol) {
+    data_block_add(pairs, model);
+    data_block_add(pairs, symbol);
+    return;
+}
+
+static void side_encode_adaptive(lz_context_t* ctx, int stream, data_block_t* pairs, data_block_t* o_block) {
+    uint64_t i;
+    int t;
+    int s;
+
+    for(i = 0; i < pairs->m_size; i += 2) {
+        t = pairs->m_data[i];
+        s = pairs->m_data[i + 1];
+        switch(stream) {
+            case M_side_spos: M_nm_enc_(ctx->coder_spos, o_block, ctx->m.spos_model, s, 1); break;
+            case M_side_pos:  M_nm_enc_(ctx->coder_pos, o_block, ctx->m.pos_models[t], s, M_inc_factor(t)); break;
+            case M_side_len:  M_fm_enc_(ctx->coder_len, o_block, ctx->m.len_model, s, 30); break;
+        }
+    }
+    switch(stream) {
+        case M_side_spos: range_encoder_flush(&ctx->coder_spos, o_block); break;
+        case M_side_pos:  range_encoder_flush(&ctx->coder_pos, o_block); break;
+        case M_side_len:  range_encoder_flush(&ctx->coder_len, o_block); break;
+    }
+    return;
+}
+
+/* code a side stream with the adaptive models, or with static rANS tables unless they cost more
+ * than 1/32 extra. a rANS coded stream leaves the adaptive models as they were, like the decoder does */
+static void side_encode(lz_context_t* ctx, int stream, data_block_t* pairs, int ntables, data_block_t* o_block) {
+    data_block_t rans_block = INITIAL_BLOCK;
+    nmodel_t pos_models[6];
+    nmodel_t spos_model = ctx->m.spos_model;
+    fmodel_t len_model = ctx->m.len_model;
+
+    memcpy(pos_models, ctx->m.pos_models, sizeof(pos_models));
+    side_encode_adaptive(ctx, stream, pairs, o_block);
+    rans_encode(pairs, ntables, &rans_block);
+
+    if(rans_block.m_size <= o_block->m_size + o_block->m_size / 32) {
+        data_block_resize(o_block, rans_block.m_size);
+        memcpy(o_block->m_data, rans_block.m_data, rans_block.m_size);
+        memcpy(ctx->m.pos_models, pos_models, sizeof(pos_models));
+        ctx->m.spos_model = spos_model;
+        ctx->m.len_model = len_model;
+        ctx->block_header.m_rans |= stream;
+    }
+    data_block_destroy(&rans_block);
+    return;
+}
+
+void lzencode(lz_context_t* ctx, data_block_t* ib, data_block_t* ob, int print_information) {
     data_block_t spos_block = INITIAL_BLOCK;
     data_block_t pos_block = INITIAL_BLOCK;
     data_block_t len_block = INITIAL_BLOCK;
+    data_block_t spos_pairs = INITIAL_BLOCK;
+    data_block_t pos_pairs = INITIAL_BLOCK;
+    data_block_t len_pairs = INITIAL_BLOCK;
+    data_block_t hb = INITIAL_BLOCK;
+    data_block_t raw_block = INITIAL_BLOCK;
+    data_block_t* raw = NULL;
+    uint32_t hlen;
+    uint64_t lit_size;
+    int      probed = 0;
     uint32_t match_pos;
     uint32_t match_len;
     uint32_t pos = 0;
@@ -162,6 +374,7 @@ void lzencode(data_block_t* ib, data_block_t* ob, int print_information) {
     uint32_t j;
     uint32_t counter[256] = {0};
     int      esc = 0;
+    uint32_t match_min;
 
     matcher_t matcher;
     pthread_t thread;
@@ -172,10 +385,30 @@ void lzencode(data_block_t* ib, data_block_t* ob, int print_information) {
     matcher_ret_t match_rets[2][M_match_rets_size];
 
     /* reserve space for block header */
-    data_block_resize(ob, sizeof(block_header));
-    block_header.m_num_spos = 0;
-    block_header.m_num_pos = 0;
-    block_header.m_num_len = 0;
+    data_block_resize(ob, sizeof(block_header_t));
+    ctx->block_header.m_num_spos = 0;
+    ctx->block_header.m_num_pos = 0;
+    ctx->block_header.m_num_len = 0;
+    ctx->block_header.m_num_lit = 0;
+    ctx->block_header.m_rans = 0;
+    ctx->block_header.m_lit_coder = lit_coder;
+    ctx->block_header.m_lit_order = 0;
+    ctx->block_header.m_lit_budget = 0;
+    ctx->block_header.m_history = history_window;
+    ctx->block_header.m_o2_budget = ppm_o2_budget;
+    if(ppm_model_setup(&ctx->m.ppm_model, ppm_o2_budget) == -1) { /* no memory for the o2 arena, store the block */
+        goto CannotCompress_nojoin_nofree;
+    }
+    if(lit_coder == LIT_CODER_PPMH) {
+        ctx->block_header.m_lit_order = ppmh_order;
+        ctx->block_header.m_lit_budget = ppmh_budget;
+        if(ppmh_model_setup(&ctx->m.ppmh_model, ppmh_order, ppmh_budget) == -1) { /* no memory for the budget, use ppm */
+            ctx->block_header.m_lit_coder = LIT_CODER_PPM;
+        }
+    }
+    if(lit_coder == LIT_CODER_CM && ppm_cm_setup(&ctx->m.ppm_model) == -1) { /* no memory for the tables, use ppm */
+        ctx->block_header.m_lit_coder = LIT_CODER_PPM;
+    }
 
     /* find escape */
     for(i = 0; i < ib->m_size; i++) {
@@ -186,33 +419,40 @@ void lzencode(data_block_t* ib, data_block_t* ob, int print_information) {
             esc = i;
         }
     }
-    block_header.m_esc = esc;
+    ctx->block_header.m_esc = esc;
 
     /* adjust match_min by blocksize */
     match_min = 10 + (ib->m_size > 16777216);
 
-    /* init matcher */
-    matcher_init(&matcher, ib->m_data, ib->m_size, print_information);
+    /* init matcher -- on the history and the block, coding starts after the history */
+    hlen = history_usable(&ctx->history, ib->m_size);
+    history_join(&ctx->history, hlen, ib, &hb);
+    matcher_init(&matcher, hb.m_data, hb.m_size, match_min, print_information);
+    for(i = (hlen > 256) ? hlen - 256 : 0; i < hlen; i++) {
+        matcher_update_cache(&matcher, hb.m_data, i);
+    }
+    pos = hlen;
+    match_nextpos = hlen;
 
     if(print_information) {
         fprintf(stderr, "%s\n", "-> running LZ77 encoding...");
     }
-    range_encoder_init(&coder_spos);
-    range_encoder_init(&coder_pos);
-    range_encoder_init(&coder_len);
-    range_encoder_init(&coder);
+    range_encoder_init(&ctx->coder_spos);
+    range_encoder_init(&ctx->coder_pos);
+    range_encoder_init(&ctx->coder_len);
+    range_encoder_init(&ctx->coder);
 
     thread_args.m_pos = &match_nextpos;
-    thread_args.m_iblock = ib;
+    thread_args.m_iblock = &hb;
     thread_args.m_matcher = &matcher;
 
     thread_args.m_rets = match_rets[0]; lzmatch_thread(&thread_args);
     thread_args.m_rets = match_rets[1]; pthread_create(&thread, 0, (void*)lzmatch_thread, &thread_args);
 
     /* start encoding */
-    while(pos < ib->m_size) {
+    while(pos < hb.m_size) {
         if(print_information) {
-            update_progress(pos, ib->m_size);
+            update_progress(pos - hlen, ib->m_size);
         }
 
         if(match_retindex >= M_match_rets_size) { /* start the next matching thread */
@@ -227,104 +467,139 @@ void lzencode(data_block_t* ib, data_block_t* ob, int print_information) {
         match_retindex += 1;
 
         if(match_pos != -1) { /* lz77 match */
-            ppm_encode(&coder, &m.ppm_model, esc, ob);
+            lit_encode_next(ctx, esc, ob, raw);
 
             if(pos - match_pos == last_match) { /* same as last match */
                 match_pos = pos;
             }
-            M_my_enc_(coder_len, &len_block, m.len_model, match_len, 30);
-            block_header.m_num_len += 1;
+            side_record(&len_pairs, 0, match_len);
+            ctx->block_header.m_num_len += 1;
 
             if(match_len < match_min) { /* shorter match */
-                M_my_enc_(coder_spos, &spos_block, m.spos_model, pos - match_pos, 1);
-                block_header.m_num_spos += 1;
+                side_record(&spos_pairs, 0, pos - match_pos);
+                ctx->block_header.m_num_spos += 1;
 
             } else { /* encode position into m.pos_models */
                 j = (pos - match_pos) * 8;
                 i = 0;
                 while(j >= 128 && i < 2) {
-                    M_my_enc_(coder_pos, &pos_block, m.pos_models[i], j % 128 + 128, M_inc_factor(i));
+                    side_record(&pos_pairs, i, j % 128 + 128);
                     i += 1;
                     j /= 128;
                 }
                 if(i >= 2) {
                     while(j >= 64 && i < 5) {
-                        M_my_enc_(coder_pos, &pos_block, m.pos_models[i], j % 64 + 64, M_inc_factor(i));
+                        side_record(&pos_pairs, i, j % 64 + 64);
                         i += 1;
                         j /= 64;
                     }
                 }
-                M_my_enc_(coder_pos, &pos_block, m.pos_models[i], j, M_inc_factor(i));
-                block_header.m_num_pos += 1;
+                side_record(&pos_pairs, i, j);
+                ctx->block_header.m_num_pos += 1;
             }
             last_match = pos - match_pos;
 
-        } else { /* literal */
-            ppm_encode(&coder, &m.ppm_model, ib->m_data[pos], ob);
-            if(ib->m_data[pos] == esc) {
-                M_my_enc_(coder_len, &len_block, m.len_model, 0, 30);
-                block_header.m_num_len += 1;
+            for(i = 0; i < match_len; i++) { /* update context */
+                ppm_update_context(&ctx->m.ppm_model, hb.m_data[pos++]);
             }
-        }
 
-        for(i = 0; i < match_len; i++) { /* update context */
-            ppm_update_context(&m.ppm_model, ib->m_data[pos++]);
+        } else { /* literal -- code it with the following literals of this batch as one run */
+            while(match_retindex < M_match_rets_size && match_rets[match_retn][match_retindex].m_pos == -1 && pos + match_len < hb.m_size) {
+                match_retindex += 1;
+                match_len += 1;
+            }
+            lit_encode_run(ctx, hb.m_data + pos, match_len, ob, raw);
+            for(i = 0; i < match_len; i++) {
+                if(hb.m_data[pos++] == esc) {
+                    side_record(&len_pairs, 0, 0);
+                    ctx->block_header.m_num_len += 1;
+                }
+            }
         }
-        if(ob->m_size >= ib->m_size) { /* cannot compress */
+
+        lit_size = ob->m_size - sizeof(block_header_t);
+        if(lit_size + raw_block.m_size >= ib->m_size) { /* cannot compress */
             goto CannotCompress;
         }
+        if(!probed && pos - hlen >= ib->m_size / 2) { /* the first half did not compress -- store the rest of literals raw if it looks no better */
+            probed = 1;
+            if(lit_size >= pos - hlen && ppm_incompressible(hb.m_data + pos, hb.m_size - pos)) {
+                raw = &raw_block; /* matches are still found and coded */
+            }
+        }
     }
 
-    range_encoder_flush(&coder, ob);
-    range_encoder_flush(&coder_spos, &spos_block);
-    range_encoder_flush(&coder_pos, &pos_block);
-    range_encoder_flush(&coder_len, &len_block);
+    range_encoder_flush(&ctx->coder, ob);
+    side_encode(ctx, M_side_spos, &spos_pairs, 1, &spos_block);
+    side_encode(ctx, M_side_pos, &pos_pairs, 6, &pos_block);
+    side_encode(ctx, M_side_len, &len_pairs, 1, &len_block);
 
     pthread_join(thread, 0);
     matcher_free(&matcher);
+    history_update(&ctx->history, ib->m_data, ib->m_size, history_window * 1048576);
+    data_block_destroy(&hb);
 
     /* set block header */
-    block_header.m_compressed = 1;
-    block_header.m_original_size = ib->m_size;
-    block_header.m_match_min = match_min;
-    block_header.m_offset_spos = ob->m_size;
-    block_header.m_offset_pos = ob->m_size + spos_block.m_size;
-    block_header.m_offset_len = ob->m_size + spos_block.m_size + pos_block.m_size;
-    memcpy(ob->m_data, &block_header, sizeof(block_header));
+    ctx->block_header.m_compressed = 1;
+    ctx->block_header.m_original_size = ib->m_size;
+    ctx->block_header.m_match_min = match_min;
+    ctx->block_header.m_offset_raw = ob->m_size;
+    data_block_append(ob, raw_block.m_data, raw_block.m_size);
+    data_block_destroy(&raw_block);
+    ctx->block_header.m_offset_spos = ob->m_size;
+    ctx->block_header.m_offset_pos = ob->m_size + spos_block.m_size;
+    ctx->block_header.m_offset_len = ob->m_size + spos_block.m_size + pos_block.m_size;
+    memcpy(ob->m_data, &ctx->block_header, sizeof(block_header_t));
 
     /* append extra blocks to ob */
     data_block_resize(ob, ob->m_size + spos_block.m_size + pos_block.m_size + len_block.m_size);
-    memcpy(ob->m_data + block_header.m_offset_spos, spos_block.m_data, spos_block.m_size);
-    memcpy(ob->m_data + block_header.m_offset_pos,  pos_block.m_data, pos_block.m_size);
-    memcpy(ob->m_data + block_header.m_offset_len,  len_block.m_data, len_block.m_size);
+    memcpy(ob->m_data + ctx->block_header.m_offset_spos, spos_block.m_data, spos_block.m_size);
+    memcpy(ob->m_data + ctx->block_header.m_offset_pos,  pos_block.m_data, pos_block.m_size);
+    memcpy(ob->m_data + ctx->block_header.m_offset_len,  len_block.m_data, len_block.m_size);
     data_block_destroy(&spos_block);
     data_block_destroy(&pos_block);
     data_block_destroy(&len_block);
+    data_block_destroy(&spos_pairs);
+    data_block_destroy(&pos_pairs);
+    data_block_destroy(&len_pairs);
     return;
 
 CannotCompress:
     pthread_join(thread, 0);
     matcher_free(&matcher);
 
-    data_block_resize(ob, sizeof(block_header) + ib->m_size);
-    memset(ob->m_data, 0, sizeof(block_header));
+CannotCompress_nojoin_nofree:
+    lz_context_restart(ctx); /* the models saw part of the block, the decoder of a stored block starts over too */
+    history_update(&ctx->history, ib->m_data, ib->m_size, history_window * 1048576);
+    data_block_destroy(&hb);
+    data_block_destroy(&raw_block);
+
+    data_block_resize(ob, sizeof(block_header_t) + ib->m_size);
+    memset(&ctx->block_header, 0, sizeof(block_header_t));
+    ctx->block_header.m_history = history_window;
+    memcpy(ob->m_data, &ctx->block_header, sizeof(block_header_t));
     for(i = 0; i < ib->m_size; i++) {
-        ob->m_data[sizeof(block_header) + i] = ib->m_data[i];
+        ob->m_data[sizeof(block_header_t) + i] = ib->m_data[i];
     }
     data_block_destroy(&spos_block);
     data_block_destroy(&pos_block);
     data_block_destroy(&len_block);
+    data_block_destroy(&spos_pairs);
+    data_block_destroy(&pos_pairs);
+    data_block_destroy(&len_pairs);
     return;
 }
 
 /* pthread-callback wrapper */
 typedef struct lzdecode_thread_param_pack_t {
+    lz_context_t* m_ctx;
     uint32_t* m_spos_queue;
     uint32_t* m_pos_queue;
     uint32_t* m_len_queue;
     uint8_t** m_input_spos;
     uint8_t** m_input_pos;
     uint8_t** m_input_len;
+    uint8_t*  m_input_end;
 } lzdecode_thread_param_pack_t;
 
 #define M_spos_queue_size   24000
@@ -332,30 +607,39 @@ typedef struct lzdecode_thread_param_pack_t {
 #define M_len_queue_size    24000
 
 static void* lzdecode_spos_thread(lzdecode_thread_param_pack_t* args) { /* thread for decoding spos */
+    lz_context_t* ctx = args->m_ctx;
     decode_symbol_t decode_helper;
     uint32_t i;
 
     /* decode spos */
-    for(i = 0; block_header.m_num_spos > 0 && i < M_spos_queue_size; i++) {
-        block_header.m_num_spos--;
-        args->m_spos_queue[i] = M_my_dec_(coder_spos, *args->m_input_spos, m.spos_model, 1);
+    for(i = 0; ctx->block_header.m_num_spos > 0 && i < M_spos_queue_size && *args->m_input_spos <= args->m_input_end; i++) {
+        ctx->block_header.m_num_spos--;
+        args->m_spos_queue[i] = (ctx->block_header.m_rans & M_side_spos)
+            ? rans_decode(&ctx->rans_spos, &ctx->rans_spos_table, args->m_input_spos)
+            : M_nm_dec_(ctx->coder_spos, *args->m_input_spos, ctx->m.spos_model, 1);
     }
+    memset(args->m_spos_queue + i, 0, (M_spos_queue_size - i) * sizeof(uint32_t)); /* never read uninitialized items */
     return 0;
 }
 
 static void* lzdecode_pos_thread(lzdecode_thread_param_pack_t* args) { /* thread for decoding pos */
+    lz_context_t* ctx = args->m_ctx;
     decode_symbol_t decode_helper;
     uint32_t i;
     uint32_t j;
     uint32_t v;
     uint32_t decode_symbol;
 
+#define M_pos_dec_(j) ((ctx->block_header.m_rans & M_side_pos) \
+        ? rans_decode(&ctx->rans_pos, &ctx->rans_pos_tables[j], args->m_input_pos) \
+        : M_nm_dec_(ctx->coder_pos, *args->m_input_pos, ctx->m.pos_models[j], M_inc_factor(j)))
+
     /* decode pos */
-    for(i = 0; block_header.m_num_pos > 0 && i < M_pos_queue_size; i++) {
-        block_header.m_num_pos--;
+    for(i = 0; ctx->block_header.m_num_pos > 0 && i < M_pos_queue_size && *args->m_input_pos <= args->m_input_end; i++) {
+        ctx->block_header.m_num_pos--;
         j = 0;
         v = 0;
-        while(j < 2 && (decode_symbol = M_my_dec_(coder_pos, *args->m_input_pos, m.pos_models[j], M_inc_factor(j))) >= 128) {
+        while(j < 2 && (decode_symbol = M_pos_dec_(j)) >= 128) {
             v += (decode_symbol - 128) * (1 << (7 * j));
             j += 1;
         }
@@ -365,36 +649,46 @@ static void* lzdecode_pos_thread(lzdecode_thread_param_pack_t* args) { /* thread
             continue;
         }
 
-        while(j < 5 && (decode_symbol = M_my_dec_(coder_pos, *args->m_input_pos, m.pos_models[j], M_inc_factor(j))) >= 64) {
+        while(j < 5 && (decode_symbol = M_pos_dec_(j)) >= 64) {
             v += (decode_symbol - 64) * (1 << ((6 * j) + 2));
             j += 1;
         }
         args->m_pos_queue[i] = v + decode_symbol * (1 << ((6 * j) + 2));
         args->m_pos_queue[i] /= 8;
     }
+    memset(args->m_pos_queue + i, 0, (M_pos_queue_size - i) * sizeof(uint32_t));
     return 0;
+#undef M_pos_dec_
 }
 
 static void* lzdecode_len_thread(lzdecode_thread_param_pack_t* args) { /* thread for decoding len */
+    lz_context_t* ctx = args->m_ctx;
     decode_symbol_t decode_helper;
     uint32_t i;
 
     /* decode len */
-    for(i = 0; block_header.m_num_len > 0 && i < M_len_queue_size; i++) {
-        block_header.m_num_len--;
-        args->m_len_queue[i] = M_my_dec_(coder_len, *args->m_input_len, m.len_model, 30);
+    for(i = 0; ctx->block_header.m_num_len > 0 && i < M_len_queue_size && *args->m_input_len <= args->m_input_end; i++) {
+        ctx->block_header.m_num_len--;
+        args->m_len_queue[i] = (ctx->block_header.m_rans & M_side_len)
+            ? rans_decode(&ctx->rans_len, &ctx->rans_len_table, args->m_input_len)
+            : M_fm_dec_(ctx->coder_len, *args->m_input_len, ctx->m.len_model, 30);
     }
+    memset(args->m_len_queue + i, 0, (M_len_queue_size - i) * sizeof(uint32_t));
     return 0;
 }
 
-void lzdecode(data_block_t* ib, data_block_t* ob, int print_information) {
+int lzdecode(lz_context_t* ctx, data_block_t* ib, data_block_t* ob, int print_information) {
     uint32_t last_match = 0;
     uint32_t i;
-    uint32_t decode_symbol;
+    int      decode_symbol;
     uint8_t* input;
+    uint8_t* input_raw;
     uint8_t* input_spos;
     uint8_t* input_pos;
     uint8_t* input_len;
+    uint8_t* input_end = ib->m_data + ib->m_size;
+    uint32_t match_min;
+    uint32_t hlen;
 
     pthread_t thread;
     lzdecode_thread_param_pack_t thread_args;
@@ -418,33 +712,88 @@ void lzdecode(data_block_t* ib, data_block_t* ob, int print_information) {
     if(print_information) {
         fprintf(stderr, "%s\n", "-> running LZ77 decoding...");
     }
-    memcpy(&block_header, ib->m_data, sizeof(block_header));
-    data_block_resize(ob, 0);
-    data_block_reserve(ob, block_header.m_original_size);
+    if(ib->m_size < sizeof(block_header_t)) {
+        return -1;
+    }
+    memcpy(&ctx->block_header, ib->m_data, sizeof(block_header_t));
+    if(ctx->block_header.m_history > HISTORY_MAX_WINDOW) {
+        return -1;
+    }
 
-    if(!block_header.m_compressed) {
-        for(i = sizeof(block_header); i < ib->m_size; i++) { /* data not compressed, no need to decompress */
+    if(!ctx->block_header.m_compressed) {
+        data_block_resize(ob, 0);
+        for(i = sizeof(block_header_t); i < ib->m_size; i++) { /* data not compressed, no need to decompress */
             data_block_add(ob, ib->m_data[i]);
         }
-        return;
+        lz_context_restart(ctx);
+        history_update(&ctx->history, ob->m_data, ob->m_size, ctx->block_header.m_history * 1048576);
+        return 0;
+    }
+    if(ctx->block_header.m_lit_coder > LIT_CODER_PPMH) {
+        return -1;
+    }
+    if(ctx->block_header.m_lit_coder == LIT_CODER_PPMH && (
+                ctx->block_header.m_lit_order < 1 || ctx->block_header.m_lit_order > PPMH_MAX_ORDER ||
+                ctx->block_header.m_lit_budget < 1 || ctx->block_header.m_lit_budget > PPMH_MAX_BUDGET ||
+                ppmh_model_setup(&ctx->m.ppmh_model, ctx->block_header.m_lit_order, ctx->block_header.m_lit_budget) == -1)) {
+        return -1;
+    }
+    if(ppm_model_setup(&ctx->m.ppm_model, ctx->block_header.m_o2_budget) == -1) { /* bad budget, or no memory for it */
+        return -1;
     }
-    input = ib->m_data + sizeof(block_header);
-    input_spos = ib->m_data + block_header.m_offset_spos;
-    input_pos = ib->m_data + block_header.m_offset_pos;
-    input_len = ib->m_data + block_header.m_offset_len;
+    if(ctx->block_header.m_lit_coder == LIT_CODER_CM && ppm_cm_setup(&ctx->m.ppm_model) == -1) {
+        return -1;
+    }
+    if(ctx->block_header.m_offset_raw < sizeof(block_header_t)
+            || ctx->block_header.m_offset_spos < ctx->block_header.m_offset_raw
+            || ctx->block_header.m_offset_pos < ctx->block_header.m_offset_spos
+            || ctx->block_header.m_offset_len < ctx->block_header.m_offset_pos
+            || ctx->block_header.m_offset_len > ib->m_size) {
+        return -1;
+    }
+    input = ib->m_data + sizeof(block_header_t);
+    input_raw = ib->m_data + ctx->block_header.m_offset_raw;
+    input_spos = ib->m_data + ctx->block_header.m_offset_spos;
+    input_pos = ib->m_data + ctx->block_header.m_offset_pos;
+    input_len = ib->m_data + ctx->block_header.m_offset_len;
 
     /* get match_min from header */
-    match_min = block_header.m_match_min;
+    match_min = ctx->block_header.m_match_min;
 
-    range_decoder_init(&coder, &input);
-    range_decoder_init(&coder_spos, &input_spos);
-    range_decoder_init(&coder_pos, &input_pos);
-    range_decoder_init(&coder_len, &input_len);
+    /* decode behind the history, matches may refer to it */
+    hlen = history_usable(&ctx->history, ctx->block_header.m_original_size);
+    history_prefix(&ctx->history, hlen, ob);
+    data_block_reserve(ob, hlen + ctx->block_header.m_original_size);
+
+    range_decoder_init(&ctx->coder, &input);
+    if(ctx->block_header.m_rans & M_side_spos) {
+        if(rans_decoder_init(&ctx->rans_spos, &ctx->rans_spos_table, 1, &input_spos, input_end) != 0) {
+            return -1;
+        }
+    } else {
+        range_decoder_init(&ctx->coder_spos, &input_spos);
+    }
+    if(ctx->block_header.m_rans & M_side_pos) {
+        if(rans_decoder_init(&ctx->rans_pos, ctx->rans_pos_tables, 6, &input_pos, input_end) != 0) {
+            return -1;
+        }
+    } else {
+        range_decoder_init(&ctx->coder_pos, &input_pos);
+    }
+    if(ctx->block_header.m_rans & M_side_len) {
+        if(rans_decoder_init(&ctx->rans_len, &ctx->rans_len_table, 1, &input_len, input_end) != 0) {
+            return -1;
+        }
+    } else {
+        range_decoder_init(&ctx->coder_len, &input_len);
+    }
 
     /* init threads */
+    thread_args.m_ctx = ctx;
     thread_args.m_input_spos = &input_spos;
     thread_args.m_input_pos = &input_pos;
     thread_args.m_input_len = &input_len;
+    thread_args.m_input_end = input_end;
 
     /* decode first block */
     thread_args.m_pos_queue = pos_queue[0];     pthread_create(&thread, 0, (void*)lzdecode_pos_thread, &thread_args);
@@ -456,14 +805,17 @@ void lzdecode(data_block_t* ib, data_block_t* ob, int print_information) {
     thread_args.m_spos_queue = spos_queue[1];   lzdecode_spos_thread(&thread_args);
 
     /* start decoding */
-    while(ob->m_size < block_header.m_original_size) {
+    while(ob->m_size - hlen < ctx->block_header.m_original_size) {
         if(print_information) {
-            update_progress(ob->m_size, block_header.m_original_size);
+            update_progress(ob->m_size - hlen, ctx->block_header.m_original_size);
         }
 
-        decode_symbol = ppm_decode(&coder, &m.ppm_model, &input);
+        decode_symbol = lit_decode_next(ctx, &input, input_end, &input_raw, ib->m_data + ctx->block_header.m_offset_spos);
+        if(decode_symbol == -1) {
+            goto Corrupted;
+        }
 
-        if(decode_symbol != block_header.m_esc) {
+        if(decode_symbol != ctx->block_header.m_esc) {
             match_len = 1;
             match_pos = decode_symbol;
         } else {
@@ -478,7 +830,7 @@ void lzdecode(data_block_t* ib, data_block_t* ob, int print_information) {
 
             if(match_len == 0) { /* escape char literal */
                 match_len = 1;
-                match_pos = block_header.m_esc;
+                match_pos = ctx->block_header.m_esc;
 
             } else if(match_len < match_min) {
                 if(spos_index >= M_spos_queue_size) { /* decode shorter match position (from queue) */
@@ -502,8 +854,12 @@ void lzdecode(data_block_t* ib, data_block_t* ob, int print_information) {
             }
 
             if(match_len > 1) {
-                match_pos = ob->m_size - ((i > 0) ? i : last_match);
-                last_match = ob->m_size - match_pos;
+                i = (i > 0) ? i : last_match;
+                if(i == 0 || i > ob->m_size || match_len > ctx->block_header.m_original_size - (ob->m_size - hlen)) {
+                    goto Corrupted;
+                }
+                match_pos = ob->m_size - i;
+                last_match = i;
             }
         }
 
@@ -518,9 +874,31 @@ void lzdecode(data_block_t* ib, data_block_t* ob, int print_information) {
         }
 
         for(i = 0; i < match_len; i++) { /* update context */
-            ppm_update_context(&m.ppm_model, ob->m_data[ob->m_size - match_len + i]);
+            ppm_update_context(&ctx->m.ppm_model, ob->m_data[ob->m_size - match_len + i]);
         }
     }
     pthread_join(thread, 0);
-    return;
+
+    if(input > input_end || input_spos > input_end || input_pos > input_end || input_len > input_end) {
+        return -1;
+    }
+    history_strip(&ctx->history, hlen, ob, ctx->block_header.m_history * 1048576);
+    return 0;
+
+Corrupted:
+    pthread_join(thread, 0);
+    return -1;
 }
+
+/* engine descriptor */
+const lz_engine_t lz_engine_rox = {
+    "comprox",
+    "\x1f\x9d\x01\x01::0.25.0-comprox",
+    lz_context_create,
+    lz_context_reset,
+    lz_context_destroy,
+    lz_context_save,
+    lz_context_load,
+    lzencode,
+    lzdecode,
+};
@@ -34,9 +34,15 @@
 #include <stdint.h>
 #include "../cr-datablock.h"
 #include "../cr-model.h"
+#include "../cr-engine.h"
 
-void reset_models();
-void lzencode(struct data_block_t* ib, struct data_block_t* ob, int print_information);
-void lzdecode(struct data_block_t* ib, struct data_block_t* ob, int print_information);
+lz_context_t* lz_context_create();
+void lz_context_reset(lz_context_t* ctx);
+void lz_context_destroy(lz_context_t* ctx);
+void lz_context_save(lz_context_t* ctx, struct data_block_t* snapshot);
+int  lz_context_load(lz_context_t* ctx, struct data_block_t* snapshot);
+
+void lzencode(lz_context_t* ctx, struct data_block_t* ib, struct data_block_t* ob, int print_information);
+int  lzdecode(lz_context_t* ctx, struct data_block_t* ib, struct data_block_t* ob, int print_information);
 
 #endif
@@ -32,7 +32,6 @@
 int flexible_parsing = 0;
 
 uint32_t match_min_near = 6;
-uint32_t match_min;
 uint32_t match_max = 255;
 uint32_t match_limit = 40; /* default */
 
@@ -40,7 +39,7 @@ static inline uint32_t hash1(unsigned char* s) {
     return s[0] + s[1];
 }
 
-static inline uint32_t hash2(unsigned char* s) {
+static inline uint32_t hash2(unsigned char* s, uint32_t match_min) {
     uint32_t hash = 0;
     uint32_t i;
 
@@ -77,7 +76,7 @@ void* matcher_init_thread(matcher_init_thread_param_pack_t* args) {
     for(i = start; i < bucketsize1; i += 2) {
         memset(bucket2, -1, bucketsize2 * sizeof(uint32_t));
         for(pos = bucket1[i]; pos != -1; pos = j) {
-            hash = hash2(data + pos) % bucketsize2;
+            hash = hash2(data + pos, matcher->m_match_min) % bucketsize2;
             j = matcher->m_next[pos];
             matcher->m_next[pos] = bucket2[hash];
             bucket2[hash] = pos;
@@ -86,7 +85,7 @@ void* matcher_init_thread(matcher_init_thread_param_pack_t* args) {
     return 0;
 }
 
-int matcher_init(matcher_t* matcher, unsigned char* data, uint32_t len, int print_information) {
+int matcher_init(matcher_t* matcher, unsigned char* data, uint32_t len, uint32_t match_min, int print_information) {
     const uint32_t bucketsize1 = 20;
     const uint32_t bucketsize2 = 20 + len / 25;
     uint32_t hash;
@@ -103,6 +102,7 @@ int matcher_init(matcher_t* matcher, unsigned char* data, uint32_t len, int prin
         fprintf(stderr, "%s\n", "-> initializing matcher...");
     }
     matcher->m_last_match = 0;
+    matcher->m_match_min = match_min;
     matcher->m_short_cache = malloc(65536 * sizeof(uint32_t));
     matcher->m_next = malloc(len * sizeof(uint32_t));
     matcher->m_ret_start = 0;
@@ -241,6 +241,7 @@ matcher_ret_t matcher_lookup(matcher_t* matcher, unsigned char* data, uint32_t p
     matcher_ret_t rets[260];
     uint32_t i;
     uint32_t maxprice;
+    uint32_t match_min = matcher->m_match_min;
 
     /* lookup at last_match first */
     if((tmpret1.m_pos = pos - matcher->m_last_match) < pos) {
@@ -47,15 +47,15 @@ typedef struct matcher_t {
     matcher_ret_t m_ret_cache[260];
     uint32_t m_ret_start;
     uint32_t m_ret_end;
+    uint32_t m_match_min;
 } matcher_t;
 
 extern int flexible_parsing;
 extern uint32_t match_min_near;
-extern uint32_t match_min;
 extern uint32_t match_max;
 extern uint32_t match_limit;
 
-int matcher_init(matcher_t* matcher, unsigned char* data, uint32_t len, int print_information);
+int matcher_init(matcher_t* matcher, unsigned char* data, uint32_t len, uint32_t match_min, int print_information);
 int matcher_free(matcher_t* matcher);
 int matcher_update_cache(matcher_t* matcher, unsigned char* data, uint32_t pos);
 
@@ -31,8 +31,12 @@
 #include <string.h>
 #include <stdint.h>
 #include "cr-matcher.h"
+#include "../cr-engine.h"
+#include "../cr-bitlit.h"
+#include "../cr-ppm.h"
+#include "../cr-ppmh.h"
+#include "../cr-history.h"
 
-const char* cr_magic_header = "\x1f\x9d\x01\x01::0.11.0-comprox";
 const char* cr_start_info = (
         "============================================\n"
         " comprox: an lz77-ari compressor            \n"
@@ -41,37 +45,74 @@ const char* cr_start_info = (
 const char* cr_usage_info = (
         "to compress:   comprox [SWITCH] e [input] [output]\n"
         "to decompress: comprox          d [input] [output]\n"
+        "to extract:    comprox          x offset length input [output]\n"
+        "to train -W:   comprox [SWITCH] t [input] [output]\n"
         "work with standard I/O streams if filenames are not given.\n"
+        "extracting only decodes blocks covering the range when blocks are independent (-T > 1 or -I),\n"
+        "otherwise it decodes from the first block.\n"
         "\n"
         "optional SWITCH:\n"
-        "   -b  set block size(MB), default = 16.\n"
+        "   -b  set block size(MB), default = 16, maximum = 4095.\n"
+        "   -T  set number of blocks coded in parallel, default = 1.\n"
+        "   -H  set history window(MB) matched across blocks with -T1, default = 0, maximum = 1024.\n"
+        "   -I  code every block independently with -T1 too, so x decodes only the blocks it needs.\n"
         "   -p  work as a precompressor.\n"
         "   -F  use PE/ELF/BMP filter.\n"
+        "   -L  set literal coder, 0 = ppm (default), 1 = binary models, 2 = context mixing,\n"
+        "       3 = hashed ppm of order -O.\n"
+        "   -O  set maximum order for -L3, default = 4, maximum = 6.\n"
+        "   -M  set memory budget(MB) for -L3, default = 64, maximum = 2048.\n"
+        "   -P  set memory budget(KB) for order-2 ppm contexts, minimum = 1, default = maximum = 17920.\n"
         "   -f  use flexible parsing.\n"
         "   -m  set maximum searching depth for LZ77 matching, default = 40.\n"
+        "   -W  start from the models in a file written with t, to compress and decompress.\n"
         "   -q  quiet mode.\n"
         "\n"
         "example:\n"
         "   comprox -m16 -b100 e enwik8 enwik8.rox\n"
-        "   comprox            d enwik8.rox enwik8\n");
+        "   comprox            d enwik8.rox enwik8\n"
+        "   comprox -T4        x 1048576 4096 enwik8.rox part\n");
 
 /* implement in src/main.c */
 extern uint32_t cr_split_size;
 extern int cr_filt_enable;
 extern int cr_prec_enable;
-extern int cr_main(int argc, char** argv);
+extern int cr_num_threads;
+extern int cr_independent;
+extern const char* cr_model_name;
+extern int cr_main(const lz_engine_t* engine, int argc, char** argv);
 
 int main(int argc, char** argv) {
-    return cr_main(argc, argv);
+    return cr_main(&lz_engine_rox, argc, argv);
 }
 
 int cr_process_arguments(int argc, char** argv) {
     while(argc >= 2 && argv[1][0] == '-') {
         switch(argv[1][1]) {
             case 'b': /* set block size */
-                if((cr_split_size = atoi(argv[1] + 2) * 1048576) <= 0) {
+                if(atoi(argv[1] + 2) <= 0 || atoi(argv[1] + 2) > 4095) { /* block sizes are stored in 32 bits */
                     goto BadSwitch;
                 }
+                cr_split_size = (uint32_t)atoi(argv[1] + 2) * 1048576;
+                break;
+
+            case 'T': /* set number of threads */
+                if((cr_num_threads = atoi(argv[1] + 2)) <= 0) {
+                    goto BadSwitch;
+                }
+                break;
+
+            case 'H': /* set history window */
+                if((history_window = atoi(argv[1] + 2)) <= 0 || history_window > HISTORY_MAX_WINDOW) {
+                    goto BadSwitch;
+                }
+                break;
+
+            case 'I': /* independent blocks */
+                if(argv[1][2] != 0) {
+                    goto BadSwitch;
+                }
+                cr_independent = 1;
                 break;
 
             case 'p': /* no LZ-stage */
@@ -95,12 +136,49 @@ int cr_process_arguments(int argc, char** argv) {
                 cr_filt_enable = 1;
                 break;
 
+            case 'L': /* set literal coder */
+                if(strlen(argv[1] + 2) != 1 || argv[1][2] < '0' || argv[1][2] > '0' + LIT_CODER_PPMH) {
+                    goto BadSwitch;
+                }
+                lit_coder = atoi(argv[1] + 2);
+                break;
+
+            case 'O': /* set maximum order for hashed ppm */
+                if((ppmh_order = atoi(argv[1] + 2)) <= 0 || ppmh_order > PPMH_MAX_ORDER) {
+                    goto BadSwitch;
+                }
+                break;
+
+            case 'M': /* set memory budget for hashed ppm */
+                if((ppmh_budget = atoi(argv[1] + 2)) <= 0 || ppmh_budget > PPMH_MAX_BUDGET) {
+                    goto BadSwitch;
+                }
+                break;
+
+            case 'P': /* set memory budget for ppm o2 contexts */
+                if((ppm_o2_budget = atoi(argv[1] + 2)) < PPM_O2_MIN_BUDGET || ppm_o2_budget > PPM_O2_MAX_BUDGET) {
+                    goto BadSwitch;
+                }
+                break;
+
             case 'm': /* set match limit */
                 if((match_limit = atoi(argv[1] + 2)) <= 0) {
                     goto BadSwitch;
                 }
                 break;
 
+            case 'W': /* start from trained models, -Wfile or -W file */
+                if(argv[1][2] != 0) {
+                    cr_model_name = argv[1] + 2;
+                } else if(argc >= 3) {
+                    cr_model_name = argv[2];
+                    memmove(argv + 1, argv + 2, (argc - 2) * sizeof(char*));
+                    argc--;
+                } else {
+                    goto BadSwitch;
+                }
+                break;
+
             case 'q': /* quiet mode */
                 if(argv[1][2] != 0) {
                     goto BadSwitch;